@@ -12,6 +12,8 @@
  * GNU General Public License for more details.
  */
 
+#include <linux/hash.h>
+
 #include "mt7601u.h"
 
 int mt7601u_wait_asic_ready(struct mt7601u_dev *dev)
@@ -28,8 +30,94 @@ int mt7601u_wait_asic_ready(struct mt7601u_dev *dev)
 	return -EIO;
 }
 
-bool mt76_poll(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
-	       int timeout)
+void __mt7601u_prof_enter(struct mt7601u_dev *dev,
+			  struct mt7601u_prof_ctx *ctx)
+{
+	struct mt7601u_reg_prof *prof = &dev->prof;
+	unsigned long flags;
+	int i, free = MT_PROF_TASKS;
+
+	spin_lock_irqsave(&prof->lock, flags);
+	for (i = 0; i < MT_PROF_TASKS; i++) {
+		if (prof->task[i] == current)
+			break;
+		if (!prof->task[i] && free == MT_PROF_TASKS)
+			free = i;
+	}
+
+	if (i < MT_PROF_TASKS) {
+		prof->depth[i]++;
+		ctx->slot = i;
+		ctx->outer = false;
+	} else {
+		/* Note: with all slots taken nesting of this task can't be
+		 *	 tracked, its inner accesses will be recorded too.
+		 */
+		if (free < MT_PROF_TASKS) {
+			prof->task[free] = current;
+			prof->depth[free] = 1;
+		}
+		ctx->slot = free;
+		ctx->outer = true;
+	}
+	spin_unlock_irqrestore(&prof->lock, flags);
+
+	if (ctx->outer)
+		ctx->start = ktime_get();
+}
+
+static struct mt7601u_prof_site *
+mt7601u_prof_site_get(struct mt7601u_reg_prof *prof,
+		      enum mt7601u_prof_type type, unsigned long ip)
+{
+	u32 h = hash_long(ip ^ type, ilog2(MT_PROF_SITES));
+	struct mt7601u_prof_site *site;
+	int i;
+
+	for (i = 0; i < MT_PROF_SITES; i++) {
+		site = &prof->sites[(h + i) % MT_PROF_SITES];
+
+		if (!site->ip) {
+			site->ip = ip;
+			site->type = type;
+			return site;
+		}
+		if (site->ip == ip && site->type == type)
+			return site;
+	}
+
+	return NULL;
+}
+
+void __mt7601u_prof_exit(struct mt7601u_dev *dev, struct mt7601u_prof_ctx *ctx,
+			 enum mt7601u_prof_type type, unsigned long ip)
+{
+	struct mt7601u_reg_prof *prof = &dev->prof;
+	struct mt7601u_prof_site *site;
+	unsigned long flags;
+	u64 ns = 0;
+
+	if (ctx->outer)
+		ns = ktime_to_ns(ktime_sub(ktime_get(), ctx->start));
+
+	spin_lock_irqsave(&prof->lock, flags);
+	if (ctx->slot < MT_PROF_TASKS && !--prof->depth[ctx->slot])
+		prof->task[ctx->slot] = NULL;
+
+	if (ctx->outer) {
+		site = mt7601u_prof_site_get(prof, type, ip);
+		if (site) {
+			site->cnt++;
+			site->ns += ns;
+		} else {
+			prof->dropped++;
+		}
+	}
+	spin_unlock_irqrestore(&prof->lock, flags);
+}
+
+static bool __mt76_poll(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
+			int timeout)
 {
 	u32 cur;
 
@@ -50,8 +138,21 @@ bool mt76_poll(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
 	return false;
 }
 
-bool mt76_poll_msec(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
-		    int timeout)
+bool mt76_poll(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
+	       int timeout)
+{
+	struct mt7601u_prof_ctx prof;
+	bool ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt76_poll(dev, offset, mask, val, timeout);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_POLL, _RET_IP_);
+
+	return ret;
+}
+
+static bool __mt76_poll_msec(struct mt7601u_dev *dev, u32 offset, u32 mask,
+			     u32 val, int timeout)
 {
 	u32 cur;
 
@@ -71,3 +172,16 @@ bool mt76_poll_msec(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
 
 	return false;
 }
+
+bool mt76_poll_msec(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
+		    int timeout)
+{
+	struct mt7601u_prof_ctx prof;
+	bool ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt76_poll_msec(dev, offset, mask, val, timeout);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_POLL, _RET_IP_);
+
+	return ret;
+}
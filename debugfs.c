@@ -13,8 +13,11 @@
  */
 
 #include <linux/debugfs.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
 
 #include "mt7601u.h"
+#include "usb.h"
 #include "eeprom.h"
 
 static int
@@ -37,6 +40,55 @@ mt76_reg_get(void *data, u64 *val)
 
 DEFINE_SIMPLE_ATTRIBUTE(fops_regval, mt76_reg_get, mt76_reg_set, "0x%08llx\n");
 
+/* Note: overrides are picked up by mt7601u_rx_aggr_work(), take the mutex so
+ *	 they don't race with the adaptation there.
+ */
+static int
+mt7601u_rx_aggr_tout_set(void *data, u64 val)
+{
+	struct mt7601u_dev *dev = data;
+
+	mutex_lock(&dev->mutex);
+	dev->rx_aggr.tout = val;
+	mutex_unlock(&dev->mutex);
+	return 0;
+}
+
+static int
+mt7601u_rx_aggr_tout_get(void *data, u64 *val)
+{
+	struct mt7601u_dev *dev = data;
+
+	*val = READ_ONCE(dev->rx_aggr.tout);
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(fops_rx_aggr_tout, mt7601u_rx_aggr_tout_get,
+			mt7601u_rx_aggr_tout_set, "%llu\n");
+
+static int
+mt7601u_rx_aggr_lmt_set(void *data, u64 val)
+{
+	struct mt7601u_dev *dev = data;
+
+	mutex_lock(&dev->mutex);
+	dev->rx_aggr.lmt = val;
+	mutex_unlock(&dev->mutex);
+	return 0;
+}
+
+static int
+mt7601u_rx_aggr_lmt_get(void *data, u64 *val)
+{
+	struct mt7601u_dev *dev = data;
+
+	*val = READ_ONCE(dev->rx_aggr.lmt);
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(fops_rx_aggr_lmt, mt7601u_rx_aggr_lmt_get,
+			mt7601u_rx_aggr_lmt_set, "%llu\n");
+
 
 static int
 mt7601u_ampdu_stat_read(struct seq_file *file, void *data)
@@ -95,6 +147,495 @@ static const struct file_operations fops_ampdu_stat = {
 	.release = single_release,
 };
 
+static int
+mt7601u_ampdu_ctl_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_ampdu_ctl ctl;
+	struct mt76_wcid *wcid;
+	struct mt76_sta *msta;
+	unsigned long flags;
+	int i;
+
+	seq_printf(file, "hw ampdu factor:\t%hhu\n", dev->ampdu_factor);
+	seq_puts(file, "wcid\tba_cap\tba\tdens_min\tdens\tbad%\n");
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(dev->wcid); i++) {
+		wcid = rcu_dereference(dev->wcid[i]);
+		if (!wcid)
+			continue;
+
+		msta = container_of(wcid, struct mt76_sta, wcid);
+
+		spin_lock_irqsave(&dev->lock, flags);
+		ctl = msta->ampdu;
+		spin_unlock_irqrestore(&dev->lock, flags);
+
+		seq_printf(file, "%d\t%hhu\t%hhu\t%hhu\t\t%hhu\t%hhu\n",
+			   wcid->idx, ctl.ba_cap, ctl.ba_size, ctl.density_min,
+			   ctl.density, ctl.bad_pct);
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int
+mt7601u_ampdu_ctl_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_ampdu_ctl_read, inode->i_private);
+}
+
+static const struct file_operations fops_ampdu_ctl = {
+	.open = mt7601u_ampdu_ctl_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+#define MT_BENCH_ITERS	1000
+
+static void mt7601u_bench_print(struct seq_file *file, const char *name,
+				u32 len, int aggr, int ret,
+				struct mt7601u_bench_res *res)
+{
+	u32 allocs;
+
+	seq_printf(file, "%s\t%u\t%d\t", name, len, aggr);
+	if (ret || !res->frames) {
+		seq_printf(file, "error %d\n", ret);
+		return;
+	}
+
+	allocs = res->allocs * 100 / res->frames;
+	seq_printf(file, "%llu\t%u.%02u\n", div_u64(res->ns, res->frames),
+		   allocs / 100, allocs % 100);
+}
+
+/* Note: reading this file runs the benchmark, interface has to be down.
+ *	 Only CPU cost of the per-packet paths is measured, nothing is sent
+ *	 to the device.
+ */
+static int
+mt7601u_bench_read(struct seq_file *file, void *data)
+{
+	static const u32 lens[] = { 64, 512, 1536 };
+	static const int aggrs[] = { 1, 4, 8 };
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_bench_res res;
+	int i, j, ret = 0;
+
+	mutex_lock(&dev->mutex);
+	if (test_bit(MT7601U_STATE_STARTED, &dev->state) ||
+	    !test_bit(MT7601U_STATE_INITIALIZED, &dev->state)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	seq_puts(file, "path\tlen\taggr\tns/frame\tallocs/frame\n");
+	for (i = 0; i < ARRAY_SIZE(lens); i++)
+		for (j = 0; j < ARRAY_SIZE(aggrs); j++) {
+			ret = mt7601u_bench_rx(dev, lens[i], aggrs[j],
+					       MT_BENCH_ITERS, &res);
+			mt7601u_bench_print(file, "rx", lens[i], aggrs[j],
+					    ret, &res);
+		}
+
+	for (i = 0; i < ARRAY_SIZE(lens); i++) {
+		ret = mt7601u_bench_tx(dev, lens[i], MT_BENCH_ITERS, &res);
+		mt7601u_bench_print(file, "tx", lens[i], 1, ret, &res);
+	}
+	ret = 0;
+out:
+	mutex_unlock(&dev->mutex);
+
+	return ret;
+}
+
+static int
+mt7601u_bench_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_bench_read, inode->i_private);
+}
+
+static const struct file_operations fops_bench = {
+	.open = mt7601u_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int
+mt7601u_tx_aggr_stat_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_tx_aggr_stats *st = &dev->tx_aggr_stats;
+	int i;
+
+	seq_printf(file, "max frames:\t%u\n", dev->tx_aggr_max);
+	seq_printf(file, "urbs:\t%llu\n", st->urbs);
+	seq_printf(file, "frames:\t%llu\n", st->frames);
+
+	seq_puts(file, "Frames per URB:\n");
+	for (i = 0; i < MT_TX_AGGR_MAX_FRAMES; i++)
+		seq_printf(file, "\t%d:\t%llu\n", i + 1, st->hist[i]);
+
+	return 0;
+}
+
+static int
+mt7601u_tx_aggr_stat_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_tx_aggr_stat_read, inode->i_private);
+}
+
+static const struct file_operations fops_tx_aggr_stat = {
+	.open = mt7601u_tx_aggr_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int
+mt7601u_tx_queues_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	unsigned long flags;
+	int i;
+
+	seq_puts(file, "ep\tentries\tused\tpending\tbytes\n");
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	for (i = 0; i < __MT_EP_OUT_MAX; i++) {
+		struct mt7601u_tx_queue *q = &dev->tx_q[i];
+
+		if (!q->e) {
+			seq_printf(file, "%d\t%u*\n", i, q->entries);
+			continue;
+		}
+
+		seq_printf(file, "%d\t%u\t%u\t%u\t%u\n", i, q->entries,
+			   q->used, skb_queue_len(&q->aggr_pending), q->bytes);
+	}
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	seq_puts(file, "* - not allocated\n");
+
+	return 0;
+}
+
+static int
+mt7601u_tx_queues_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_tx_queues_read, inode->i_private);
+}
+
+static const struct file_operations fops_tx_queues = {
+	.open = mt7601u_tx_queues_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const char * const mt7601u_sw_stat_names[__MT_SW_STAT_MAX] = {
+	[MT_SW_STAT_RX_URBS] =			"rx_urbs",
+	[MT_SW_STAT_RX_SEGS] =			"rx_segs",
+	[MT_SW_STAT_RX_URB_ERR] =		"rx_urb_err",
+	[MT_SW_STAT_RX_SUBMIT_ERR] =		"rx_submit_err",
+	[MT_SW_STAT_RX_PAGE_ALLOC_FAIL] =	"rx_page_alloc_fail",
+	[MT_SW_STAT_RX_SKB_ALLOC_FAIL] =	"rx_skb_alloc_fail",
+	[MT_SW_STAT_RX_BAD_FRAME] =		"rx_bad_frame",
+	[MT_SW_STAT_TX_URB_ERR] =		"tx_urb_err",
+	[MT_SW_STAT_TX_SUBMIT_ERR] =		"tx_submit_err",
+	[MT_SW_STAT_TX_QUEUE_STOP] =		"tx_queue_stop",
+	[MT_SW_STAT_TX_QUEUE_WAKE] =		"tx_queue_wake",
+	[MT_SW_STAT_VEND_REQ_RETRY] =		"vend_req_retry",
+	[MT_SW_STAT_VEND_REQ_FAIL] =		"vend_req_fail",
+};
+
+/* Note: output is one "name value" pair per line so it can be scraped. */
+static int
+mt7601u_sw_stat_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	u64 sum[__MT_SW_STAT_MAX];
+	unsigned int used_max[__MT_EP_OUT_MAX];
+	unsigned long flags;
+	int i;
+
+	mt7601u_sw_stat_sum(dev, sum);
+
+	for (i = 0; i < __MT_SW_STAT_MAX; i++)
+		seq_printf(file, "%s %llu\n", mt7601u_sw_stat_names[i], sum[i]);
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	for (i = 0; i < __MT_EP_OUT_MAX; i++)
+		used_max[i] = dev->tx_q[i].used_max;
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	for (i = 0; i < __MT_EP_OUT_MAX; i++)
+		seq_printf(file, "tx_ring%d_used_max %u\n", i, used_max[i]);
+
+	seq_printf(file, "vend_req_cnt %llu\n", dev->vend_req_cnt);
+
+	return 0;
+}
+
+static int
+mt7601u_sw_stat_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_sw_stat_read, inode->i_private);
+}
+
+static const struct file_operations fops_sw_stat = {
+	.open = mt7601u_sw_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const char * const mt7601u_lat_names[__MT_LAT_MAX] = {
+	[MT_LAT_VEND_REQ] =		"vend_req",
+	[MT_LAT_MCU_CMD] =		"mcu_cmd",
+	[MT_LAT_TX_URB] =		"tx_urb",
+	[MT_LAT_RX_TURNAROUND] =	"rx_turnaround",
+};
+
+/* Note: struct mt7601u_lat_stats is too big for the stack, per-CPU copies
+ *	 are taken one histogram at a time.
+ */
+static void
+mt7601u_lat_sum(struct mt7601u_dev *dev, struct mt7601u_lat_stats *sum)
+{
+	int cpu, i, j;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for_each_possible_cpu(cpu) {
+		const struct mt7601u_sw_stats *st;
+
+		st = per_cpu_ptr(dev->sw_stats, cpu);
+		for (i = 0; i < __MT_LAT_MAX; i++) {
+			u64 hist[MT_LAT_HIST_LEN], sum_us;
+			unsigned int start;
+
+			do {
+				start = u64_stats_fetch_begin_irq(&st->syncp);
+				memcpy(hist, st->lat.hist[i], sizeof(hist));
+				sum_us = st->lat.sum_us[i];
+			} while (u64_stats_fetch_retry_irq(&st->syncp, start));
+
+			for (j = 0; j < MT_LAT_HIST_LEN; j++)
+				sum->hist[i][j] += hist[j];
+			sum->sum_us[i] += sum_us;
+		}
+	}
+}
+
+/* Note: one line per histogram: name, count, total time in us and bucket
+ *	 counts.  Bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us.
+ *	 Writing anything to the file resets histograms.
+ */
+static int
+mt7601u_latency_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_lat_stats *lat;
+	int i, j;
+
+	lat = kmalloc(sizeof(*lat), GFP_KERNEL);
+	if (!lat)
+		return -ENOMEM;
+
+	mt7601u_lat_sum(dev, lat);
+
+	mutex_lock(&dev->mutex);
+	for (i = 0; i < __MT_LAT_MAX; i++) {
+		u64 cnt = 0;
+
+		for (j = 0; j < MT_LAT_HIST_LEN; j++) {
+			lat->hist[i][j] -= dev->lat_base.hist[i][j];
+			cnt += lat->hist[i][j];
+		}
+		lat->sum_us[i] -= dev->lat_base.sum_us[i];
+
+		seq_printf(file, "%s %llu %llu", mt7601u_lat_names[i],
+			   cnt, lat->sum_us[i]);
+		for (j = 0; j < MT_LAT_HIST_LEN; j++)
+			seq_printf(file, " %llu", lat->hist[i][j]);
+		seq_putc(file, '\n');
+	}
+	mutex_unlock(&dev->mutex);
+
+	kfree(lat);
+
+	return 0;
+}
+
+static int
+mt7601u_latency_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_latency_read, inode->i_private);
+}
+
+static ssize_t
+mt7601u_latency_write(struct file *f, const char __user *buf,
+		      size_t count, loff_t *ppos)
+{
+	struct seq_file *file = f->private_data;
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_lat_stats *lat;
+
+	lat = kmalloc(sizeof(*lat), GFP_KERNEL);
+	if (!lat)
+		return -ENOMEM;
+
+	mt7601u_lat_sum(dev, lat);
+
+	mutex_lock(&dev->mutex);
+	dev->lat_base = *lat;
+	mutex_unlock(&dev->mutex);
+
+	kfree(lat);
+
+	return count;
+}
+
+static const struct file_operations fops_latency = {
+	.open = mt7601u_latency_open,
+	.read = seq_read,
+	.write = mt7601u_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const char * const mt7601u_prof_names[] = {
+	[MT_PROF_RR] = "rr",
+	[MT_PROF_WR] = "wr",
+	[MT_PROF_RMW] = "rmw",
+	[MT_PROF_RR_SPAN] = "rr_span",
+	[MT_PROF_POLL] = "poll",
+	[MT_PROF_VEND] = "vend_req",
+	[MT_PROF_RF] = "rf",
+	[MT_PROF_BBP] = "bbp",
+	[MT_PROF_MCU] = "mcu",
+};
+
+static int mt7601u_prof_site_cmp(const void *a, const void *b)
+{
+	const struct mt7601u_prof_site *sa = a, *sb = b;
+
+	if (sa->ns == sb->ns)
+		return 0;
+	return sa->ns < sb->ns ? 1 : -1;
+}
+
+/* Note: top sites by total time: time in us, number of calls, access type
+ *	 and the caller.  Writing anything to the file clears the profile,
+ *	 recording is enabled by reg_prof_enable.
+ */
+static int
+mt7601u_reg_prof_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_reg_prof *prof = &dev->prof;
+	struct mt7601u_prof_site *sites;
+	unsigned long flags;
+	u64 dropped;
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(mt7601u_prof_names) != __MT_PROF_MAX);
+
+	sites = kmalloc(sizeof(prof->sites), GFP_KERNEL);
+	if (!sites)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&prof->lock, flags);
+	memcpy(sites, prof->sites, sizeof(prof->sites));
+	dropped = prof->dropped;
+	spin_unlock_irqrestore(&prof->lock, flags);
+
+	sort(sites, MT_PROF_SITES, sizeof(*sites), mt7601u_prof_site_cmp, NULL);
+
+	seq_printf(file, "dropped:\t%llu\n", dropped);
+	for (i = 0; i < MT_PROF_TOP && sites[i].ip; i++)
+		seq_printf(file, "%llu\t%llu\t%s\t%pS\n",
+			   div_u64(sites[i].ns, NSEC_PER_USEC), sites[i].cnt,
+			   mt7601u_prof_names[sites[i].type],
+			   (void *)sites[i].ip);
+
+	kfree(sites);
+
+	return 0;
+}
+
+static int
+mt7601u_reg_prof_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_reg_prof_read, inode->i_private);
+}
+
+static ssize_t
+mt7601u_reg_prof_write(struct file *f, const char __user *buf,
+		       size_t count, loff_t *ppos)
+{
+	struct seq_file *file = f->private_data;
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_reg_prof *prof = &dev->prof;
+	unsigned long flags;
+
+	spin_lock_irqsave(&prof->lock, flags);
+	memset(prof->sites, 0, sizeof(prof->sites));
+	prof->dropped = 0;
+	spin_unlock_irqrestore(&prof->lock, flags);
+
+	return count;
+}
+
+static const struct file_operations fops_reg_prof = {
+	.open = mt7601u_reg_prof_open,
+	.read = seq_read,
+	.write = mt7601u_reg_prof_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int
+mt7601u_rx_poll_stat_read(struct seq_file *file, void *data)
+{
+	struct mt7601u_dev *dev = file->private;
+	struct mt7601u_rx_poll_stats *st = &dev->rx_q.poll_stats;
+	int i;
+
+	seq_printf(file, "budget:\t%u\n", dev->rx_q.budget);
+	seq_printf(file, "polls:\t%llu\n", st->polls);
+	seq_printf(file, "frames:\t%llu\n", st->frames);
+	seq_printf(file, "budget_exhausted:\t%llu\n", st->budget_exhausted);
+
+	seq_puts(file, "Frames per poll:\n");
+	seq_printf(file, "\t0:\t%llu\n", st->hist[0]);
+	for (i = 1; i < MT_RX_POLL_HIST_LEN - 1; i++)
+		seq_printf(file, "\t%u-%u:\t%llu\n",
+			   1 << (i - 1), (1 << i) - 1, st->hist[i]);
+	seq_printf(file, "\t%u+:\t%llu\n", 1 << (i - 1), st->hist[i]);
+
+	return 0;
+}
+
+static int
+mt7601u_rx_poll_stat_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, mt7601u_rx_poll_stat_read, inode->i_private);
+}
+
+static const struct file_operations fops_rx_poll_stat = {
+	.open = mt7601u_rx_poll_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int
 mt7601u_eeprom_param_read(struct seq_file *file, void *data)
 {
@@ -167,7 +708,40 @@ void mt7601u_init_debugfs(struct mt7601u_dev *dev)
 	debugfs_create_u32("regidx", S_IRUSR | S_IWUSR, dir, &dev->debugfs_reg);
 	debugfs_create_file("regval", S_IRUSR | S_IWUSR, dir, dev,
 			    &fops_regval);
+	debugfs_create_u64("vendor_req_cnt", S_IRUSR | S_IWUSR, dir,
+			   &dev->vend_req_cnt);
+	debugfs_create_u32("mac_work_ms", S_IRUSR | S_IWUSR, dir,
+			   &dev->mac_work_ms);
 	debugfs_create_file("ampdu_stat", S_IRUSR, dir, dev, &fops_ampdu_stat);
+	debugfs_create_file("ampdu_ctl", S_IRUSR, dir, dev, &fops_ampdu_ctl);
+	debugfs_create_file("sw_stat", S_IRUSR, dir, dev, &fops_sw_stat);
+	debugfs_create_u64("reg_shadow_hits", S_IRUSR, dir, &dev->shadow.hits);
+	debugfs_create_u64("reg_shadow_misses", S_IRUSR, dir,
+			   &dev->shadow.misses);
+	debugfs_create_file("latency", S_IRUSR | S_IWUSR, dir, dev,
+			    &fops_latency);
+	debugfs_create_u32("reg_prof_enable", S_IRUSR | S_IWUSR, dir,
+			   &dev->prof.enabled);
+	debugfs_create_file("reg_prof", S_IRUSR | S_IWUSR, dir, dev,
+			    &fops_reg_prof);
+	debugfs_create_u32("tx_aggr_max", S_IRUSR | S_IWUSR, dir,
+			   &dev->tx_aggr_max);
+	debugfs_create_u32("tx_byte_limit", S_IRUSR | S_IWUSR, dir,
+			   &dev->tx_byte_limit);
+	debugfs_create_file("bench", S_IRUSR, dir, dev, &fops_bench);
+	debugfs_create_file("tx_aggr_stat", S_IRUSR, dir, dev,
+			    &fops_tx_aggr_stat);
+	debugfs_create_file("tx_queues", S_IRUSR, dir, dev, &fops_tx_queues);
+	debugfs_create_u32("rx_aggr_manual", S_IRUSR | S_IWUSR, dir,
+			   &dev->rx_aggr.manual);
+	debugfs_create_file("rx_aggr_tout", S_IRUSR | S_IWUSR, dir, dev,
+			    &fops_rx_aggr_tout);
+	debugfs_create_file("rx_aggr_lmt", S_IRUSR | S_IWUSR, dir, dev,
+			    &fops_rx_aggr_lmt);
+	debugfs_create_u32("rx_budget", S_IRUSR | S_IWUSR, dir,
+			   &dev->rx_q.budget);
+	debugfs_create_file("rx_poll_stat", S_IRUSR, dir, dev,
+			    &fops_rx_poll_stat);
 	debugfs_create_file("eeprom_param", S_IRUSR, dir, dev,
 			    &fops_eeprom_param);
 }
@@ -16,6 +16,27 @@
 #include "usb.h"
 #include "trace.h"
 
+static unsigned int tx_ring_size[__MT_EP_OUT_MAX] = {
+	[0 ... __MT_EP_OUT_MAX - 1] = N_TX_ENTRIES
+};
+module_param_array(tx_ring_size, uint, NULL, S_IRUGO);
+MODULE_PARM_DESC(tx_ring_size,
+		 "number of URBs in the TX ring of each USB OUT endpoint");
+
+static unsigned int rx_urb_order = MT_RX_ORDER;
+module_param(rx_urb_order, uint, S_IRUGO);
+MODULE_PARM_DESC(rx_urb_order, "size of RX URBs as page order");
+
+static unsigned int rx_urbs = N_RX_ENTRIES;
+module_param(rx_urbs, uint, S_IRUGO);
+MODULE_PARM_DESC(rx_urbs, "number of RX URBs");
+
+static unsigned int mt7601u_rx_order(void)
+{
+	return clamp_t(unsigned int, rx_urb_order,
+		       MT_RX_ORDER_MIN, MT_RX_ORDER_MAX);
+}
+
 static unsigned int ieee80211_get_hdrlen_from_buf(const u8 *data, unsigned len)
 {
 	const struct ieee80211_hdr *hdr = (const struct ieee80211_hdr *)data;
@@ -31,38 +52,68 @@ static unsigned int ieee80211_get_hdrlen_from_buf(const u8 *data, unsigned len)
 
 static struct sk_buff *
 mt7601u_rx_skb_from_seg(struct mt7601u_dev *dev, struct mt7601u_rxwi *rxwi,
-			u8 *data, u32 seg_len)
+			u8 *data, u32 seg_len, u32 truesize, struct page *p)
 {
 	struct sk_buff *skb;
+	u32 true_len, hdr_len = 0, copy, frag;
 
-	if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_L2PAD))
-		seg_len -= 2;
-
-	skb = alloc_skb(seg_len, GFP_ATOMIC);
-	if (!skb)
+	skb = alloc_skb(p ? 128 : seg_len, GFP_ATOMIC);
+	if (!skb) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_RX_SKB_ALLOC_FAIL);
 		return NULL;
+	}
 
 	memset(skb->cb, 0, sizeof(skb->cb));
 
-	if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_L2PAD)) {
-		int hdr_len = ieee80211_get_hdrlen_from_buf(data, seg_len);
+	true_len = mt76_mac_process_rx(dev, skb, data, seg_len, rxwi);
+	if (!true_len || true_len > seg_len)
+		goto bad_frame;
+
+	hdr_len = ieee80211_get_hdrlen_from_buf(data, true_len);
+	if (!hdr_len)
+		goto bad_frame;
 
+	/* Drop the L2 pad by copying the header separately, the rest of the
+	 * frame can then be attached without moving any data.
+	 */
+	if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_L2PAD)) {
 		memcpy(skb_put(skb, hdr_len), data, hdr_len);
+
 		data += hdr_len + 2;
-		seg_len -= hdr_len;
+		true_len -= hdr_len;
+		hdr_len = 0;
 	}
 
-	memcpy(skb_put(skb, seg_len), data, seg_len);
+	/* If not doing paged RX allocated skb will always have enough space */
+	copy = (true_len <= skb_tailroom(skb)) ? true_len : hdr_len + 8;
+	frag = true_len - copy;
+
+	memcpy(skb_put(skb, copy), data, copy);
+	data += copy;
+
+	if (frag) {
+		skb_add_rx_frag(skb, 0, p, data - (u8 *)page_address(p),
+				frag, truesize);
+		get_page(p);
+	}
 
 	return skb;
+
+bad_frame:
+	mt7601u_sw_stat_inc(dev, MT_SW_STAT_RX_BAD_FRAME);
+	dev_err_ratelimited(dev->dev, "Error: incorrect frame len:%u hdr:%u\n",
+			    true_len, hdr_len);
+	dev_kfree_skb(skb);
+	return NULL;
 }
 
-static void
-mt7601u_rx_process_seg(struct mt7601u_dev *dev, u8 *data, u32 seg_len)
+static void mt7601u_rx_process_seg(struct mt7601u_dev *dev, u8 *data,
+				   u32 seg_len, struct page *p,
+				   struct sk_buff_head *frames)
 {
 	struct sk_buff *skb;
 	struct mt7601u_rxwi *rxwi;
-	u32 fce_info;
+	u32 fce_info, truesize = seg_len;
 
 	/* DMA_INFO field at the begining of the segment contains only some of
 	 * the information, we need to read the FCE descriptor from the end.
@@ -84,16 +135,11 @@ mt7601u_rx_process_seg(struct mt7601u_dev *dev, u8 *data, u32 seg_len)
 
 	trace_mt_rx(dev, rxwi, fce_info);
 
-	skb = mt7601u_rx_skb_from_seg(dev, rxwi, data, seg_len);
+	skb = mt7601u_rx_skb_from_seg(dev, rxwi, data, seg_len, truesize, p);
 	if (!skb)
 		return;
 
-	if (mt76_mac_process_rx(dev, skb, rxwi)) {
-		dev_kfree_skb(skb);
-		return;
-	}
-
-	ieee80211_rx_ni(dev->hw, skb);
+	__skb_queue_tail(frames, skb);
 }
 
 static u16 mt7601u_rx_next_seg_len(u8 *data, u32 data_len)
@@ -111,18 +157,28 @@ static u16 mt7601u_rx_next_seg_len(u8 *data, u32 data_len)
 	return MT_DMA_HDRS + dma_len;
 }
 
-static void
-mt7601u_rx_process_entry(struct mt7601u_dev *dev, struct mt7601u_dma_buf *e)
+static int
+mt7601u_rx_process_entry(struct mt7601u_dev *dev, struct mt7601u_dma_buf_rx *e,
+			 struct sk_buff_head *frames)
 {
 	u32 seg_len, data_len = e->urb->actual_length;
-	u8 *data = e->buf;
+	u8 *data = page_address(e->p);
+	struct page *new_p = NULL;
 	int cnt = 0;
 
 	if (!test_bit(MT7601U_STATE_INITIALIZED, &dev->state))
-		return;
+		return 0;
+
+	/* Copy if there is very little data in the buffer. */
+	if (data_len > 512) {
+		new_p = dev_alloc_pages(dev->rx_q.order);
+		if (!new_p)
+			mt7601u_sw_stat_inc(dev, MT_SW_STAT_RX_PAGE_ALLOC_FAIL);
+	}
 
 	while ((seg_len = mt7601u_rx_next_seg_len(data, data_len))) {
-		mt7601u_rx_process_seg(dev, data, seg_len);
+		mt7601u_rx_process_seg(dev, data, seg_len, new_p ? e->p : NULL,
+				       frames);
 
 		data_len -= seg_len;
 		data += seg_len;
@@ -130,14 +186,106 @@ mt7601u_rx_process_entry(struct mt7601u_dev *dev, struct mt7601u_dma_buf *e)
 	}
 
 	if (cnt > 1)
-		trace_mt_rx_dma_aggr(dev, cnt);
+		trace_mt_rx_dma_aggr(dev, cnt, !!new_p);
+
+	if (likely(!READ_ONCE(dev->rx_bench))) {
+		dev->rx_aggr.urbs++;
+		dev->rx_aggr.bytes += e->urb->actual_length;
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_RX_URBS);
+		mt7601u_sw_stat_add(dev, MT_SW_STAT_RX_SEGS, cnt);
+	}
+
+	if (new_p) {
+		/* we have one extra ref from the allocator */
+		__free_pages(e->p, dev->rx_q.order);
+
+		e->p = new_p;
+	}
+
+	return cnt;
+}
+
+/* Note: synthetic URB payloads are copied into the RX page before every
+ *	 run, like DMA would, only mt7601u_rx_process_entry() is timed.
+ *	 Frames are plain data frames not matching our BSSID so connection
+ *	 monitoring stays untouched.  Bench only runs with the interface
+ *	 down, @rx_bench keeps the URBs out of RX counters.
+ */
+int mt7601u_bench_rx(struct mt7601u_dev *dev, u32 frame_len, int aggr,
+		     int iters, struct mt7601u_bench_res *res)
+{
+	u32 seg_len, buf_len = PAGE_SIZE << dev->rx_q.order;
+	struct mt7601u_dma_buf_rx e = {};
+	struct sk_buff_head frames;
+	struct page *old_p;
+	u8 *tmpl, *data;
+	ktime_t start;
+	int i, ret = 0;
+
+	frame_len = max_t(u32, frame_len, sizeof(struct ieee80211_hdr_3addr));
+	seg_len = MT_DMA_HDRS + sizeof(struct mt7601u_rxwi) +
+		  round_up(frame_len, 4);
+	if (aggr < 1 || seg_len * aggr > buf_len)
+		return -E2BIG;
+
+	tmpl = kzalloc(seg_len * aggr, GFP_KERNEL);
+	e.urb = usb_alloc_urb(0, GFP_KERNEL);
+	e.p = dev_alloc_pages(dev->rx_q.order);
+	if (!tmpl || !e.urb || !e.p) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0, data = tmpl; i < aggr; i++, data += seg_len) {
+		struct mt7601u_rxwi *rxwi = (void *)(data + MT_DMA_HDR_LEN);
+		struct ieee80211_hdr *hdr = (void *)(rxwi + 1);
+
+		put_unaligned_le16(seg_len - MT_DMA_HDRS, data);
+		rxwi->ctl = cpu_to_le32(MT76_SET(MT_RXWI_CTL_MPDU_LEN,
+						 frame_len));
+		hdr->frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA |
+						 IEEE80211_STYPE_DATA);
+	}
+
+	__skb_queue_head_init(&frames);
+	memset(res, 0, sizeof(*res));
+	WRITE_ONCE(dev->rx_bench, true);
+
+	for (i = 0; i < iters; i++) {
+		memcpy(page_address(e.p), tmpl, seg_len * aggr);
+		e.urb->actual_length = seg_len * aggr;
+		old_p = e.p;
+
+		start = ktime_get();
+		mt7601u_rx_process_entry(dev, &e, &frames);
+		res->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		res->frames += skb_queue_len(&frames);
+		res->allocs += skb_queue_len(&frames) + (e.p != old_p);
+		__skb_queue_purge(&frames);
+	}
+
+	WRITE_ONCE(dev->rx_bench, false);
+
+	for (i = 0; i < iters; i++) {
+		start = ktime_get();
+		res->ns -= min_t(u64, res->ns,
+				 ktime_to_ns(ktime_sub(ktime_get(), start)));
+	}
+out:
+	if (e.p)
+		__free_pages(e.p, dev->rx_q.order);
+	usb_free_urb(e.urb);
+	kfree(tmpl);
+
+	return ret;
 }
 
-static struct mt7601u_dma_buf *
+static struct mt7601u_dma_buf_rx *
 mt7601u_rx_get_pending_entry(struct mt7601u_dev *dev)
 {
 	struct mt7601u_rx_queue *q = &dev->rx_q;
-	struct mt7601u_dma_buf *buf = NULL;
+	struct mt7601u_dma_buf_rx *buf = NULL;
 	unsigned long flags;
 
 	spin_lock_irqsave(&dev->rx_lock, flags);
@@ -162,92 +310,218 @@ static void mt7601u_complete_rx(struct urb *urb)
 
 	spin_lock_irqsave(&dev->rx_lock, flags);
 
-	if (mt7601u_urb_has_error(urb))
+	if (mt7601u_urb_has_error(urb)) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_RX_URB_ERR);
 		dev_err(dev->dev, "Error: RX urb failed:%d\n", urb->status);
+	}
 	if (WARN_ONCE(q->e[q->end].urb != urb, "RX urb mismatch"))
 		goto out;
 
+	q->e[q->end].done = ktime_get();
 	q->end = (q->end + 1) % q->entries;
 	q->pending++;
-	tasklet_schedule(&dev->rx_tasklet);
+	mt7601u_rx_kick(dev);
 out:
 	spin_unlock_irqrestore(&dev->rx_lock, flags);
 }
 
+static int mt7601u_submit_rx_buf(struct mt7601u_dev *dev,
+				 struct mt7601u_dma_buf_rx *e, gfp_t gfp)
+{
+	struct usb_device *usb_dev = mt7601u_to_usb_dev(dev);
+	u8 *buf = page_address(e->p);
+	unsigned pipe;
+	int ret;
+
+	pipe = usb_rcvbulkpipe(usb_dev, dev->in_eps[MT_EP_IN_PKT_RX]);
+
+	usb_fill_bulk_urb(e->urb, usb_dev, pipe, buf,
+			  PAGE_SIZE << dev->rx_q.order,
+			  mt7601u_complete_rx, dev);
+
+	/* Time buffer spent between completion and resubmission */
+	if (ktime_to_ns(e->done)) {
+		mt7601u_lat_account(dev, MT_LAT_RX_TURNAROUND, e->done);
+		e->done = ktime_set(0, 0);
+	}
+
+	trace_mt_submit_urb(dev, e->urb);
+	ret = usb_submit_urb(e->urb, gfp);
+	/* URBs poisoned for suspend or doze are refused with -EPERM */
+	if (ret && ret != -EPERM) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_RX_SUBMIT_ERR);
+		dev_err(dev->dev, "Error: submit RX URB failed:%d\n", ret);
+	}
+
+	return ret;
+}
+
+static void
+mt7601u_rx_poll_account(struct mt7601u_dev *dev, int frames, bool exhausted)
+{
+	struct mt7601u_rx_poll_stats *st = &dev->rx_q.poll_stats;
+
+	st->polls++;
+	st->frames += frames;
+	st->budget_exhausted += exhausted;
+	st->hist[min_t(int, frames ? ilog2(frames) + 1 : 0,
+		       MT_RX_POLL_HIST_LEN - 1)]++;
+
+	trace_mt_rx_poll(dev, frames, exhausted);
+}
+
+/* Note: this works like a NAPI poll - at most @budget frames are delivered
+ *	 per run and, if there is more work pending, the tasklet is simply
+ *	 rescheduled so that other softirq users get a chance to run.
+ *	 Frames are delivered as a batch after all entries are parsed and URBs
+ *	 are resubmitted back to back once parsing is done.
+ */
 static void mt7601u_rx_tasklet(unsigned long data)
 {
 	struct mt7601u_dev *dev = (struct mt7601u_dev *) data;
-	struct mt7601u_dma_buf *e;
+	struct mt7601u_dma_buf_rx *done[N_RX_ENTRIES];
+	struct mt7601u_dma_buf_rx *e;
+	struct sk_buff_head frames;
+	struct sk_buff *skb;
+	int i, n_done = 0, cnt = 0;
+	int budget = max_t(int, 1, READ_ONCE(dev->rx_q.budget));
+	bool more;
 
-	while ((e = mt7601u_rx_get_pending_entry(dev))) {
+	__skb_queue_head_init(&frames);
+
+	while (cnt < budget && (e = mt7601u_rx_get_pending_entry(dev))) {
 		if (e->urb->status)
 			continue;
 
-		mt7601u_rx_process_entry(dev, e);
-		mt7601u_usb_submit_buf(dev, USB_DIR_IN, MT_EP_IN_PKT_RX, e,
-				       GFP_ATOMIC, mt7601u_complete_rx, dev);
+		cnt += mt7601u_rx_process_entry(dev, e, &frames);
+		done[n_done++] = e;
 	}
+
+	while ((skb = __skb_dequeue(&frames)))
+		ieee80211_rx(dev->hw, skb);
+
+	for (i = 0; i < n_done; i++)
+		mt7601u_submit_rx_buf(dev, done[i], GFP_ATOMIC);
+
+	more = cnt >= budget && READ_ONCE(dev->rx_q.pending);
+	mt7601u_rx_poll_account(dev, cnt, more);
+
+	if (more)
+		mt7601u_rx_kick(dev);
+}
+
+/* Note: mac80211 expects RX and TX status calls with BHs disabled, the work
+ *	 items only provide a schedulable context with settable affinity.
+ */
+static void mt7601u_rx_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       rx_work);
+
+	local_bh_disable();
+	mt7601u_rx_tasklet((unsigned long) dev);
+	local_bh_enable();
 }
 
+static void mt7601u_tx_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       tx_work);
+
+	local_bh_disable();
+	mt7601u_tx_tasklet((unsigned long) dev);
+	local_bh_enable();
+}
+
+static void mt7601u_tx_aggr_flush(struct mt7601u_dev *dev,
+				  struct mt7601u_tx_queue *q);
+
 static void mt7601u_complete_tx(struct urb *urb)
 {
 	struct mt7601u_tx_queue *q = urb->context;
 	struct mt7601u_dev *dev = q->dev;
+	struct mt7601u_dma_buf_tx *e;
 	struct sk_buff *skb;
 	unsigned long flags;
+	int qid;
 
 	spin_lock_irqsave(&dev->tx_lock, flags);
 
-	if (mt7601u_urb_has_error(urb))
+	if (mt7601u_urb_has_error(urb)) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_TX_URB_ERR);
 		dev_err(dev->dev, "Error: TX urb failed:%d\n", urb->status);
+	}
 	if (WARN_ONCE(q->e[q->start].urb != urb, "TX urb mismatch"))
 		goto out;
 
-	skb = q->e[q->start].skb;
-	trace_mt_tx_dma_done(dev, skb);
-
-	mt7601u_tx_status(dev, skb);
-
-	if (q->used == q->entries - q->entries/8)
-		ieee80211_wake_queue(dev->hw, skb_get_queue_mapping(skb));
+	e = &q->e[q->start];
+	mt7601u_lat_account(dev, MT_LAT_TX_URB, e->submitted);
+	if (e->skb) {
+		skb = e->skb;
+		qid = skb_get_queue_mapping(skb);
+
+		trace_mt_tx_dma_done(dev, skb);
+		q->bytes -= skb->len;
+		mt7601u_tx_status(dev, skb);
+	} else {
+		qid = skb_get_queue_mapping(skb_peek(&e->aggr));
+
+		while ((skb = __skb_dequeue(&e->aggr))) {
+			trace_mt_tx_dma_done(dev, skb);
+			q->bytes -= skb->len;
+			mt7601u_tx_status(dev, skb);
+		}
+		set_bit(e->aggr_buf, &q->aggr_buf_free);
+	}
 
 	q->start = (q->start + 1) % q->entries;
 	q->used--;
 
+	/* Freed slot is a natural point to send what got queued meanwhile */
+	mt7601u_tx_aggr_flush(dev, q);
+
+	/* Off channel queues stay stopped, scan wakes them on return */
+	if (q->used + skb_queue_len(&q->aggr_pending) <
+	    q->entries - q->entries/8 &&
+	    !test_bit(MT7601U_STATE_OFFCHANNEL, &dev->state) &&
+	    ieee80211_queue_stopped(dev->hw, qid)) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_TX_QUEUE_WAKE);
+		ieee80211_wake_queue(dev->hw, qid);
+	}
+
+	mt7601u_tx_kick(dev);
+
 	if (urb->status)
 		goto out;
 
+	/* TX completion starts the status poll, see mt7601u_tx_stat() */
 	set_bit(MT7601U_STATE_MORE_STATS, &dev->state);
-	if (!test_and_set_bit(MT7601U_STATE_READING_STATS, &dev->state))
+	if (!test_and_set_bit(MT7601U_STATE_READING_STATS, &dev->state)) {
+		dev->tx_stat_poll_ms = MT_TX_STAT_POLL_MS;
 		queue_delayed_work(dev->stat_wq, &dev->stat_work,
-				   msecs_to_jiffies(10));
+				   msecs_to_jiffies(MT_TX_STAT_POLL_MS));
+	}
 out:
 	spin_unlock_irqrestore(&dev->tx_lock, flags);
 }
 
-static int mt7601u_dma_submit_tx(struct mt7601u_dev *dev,
-				 struct sk_buff *skb, u8 ep)
+static int mt7601u_dma_submit_urb(struct mt7601u_dev *dev,
+				  struct mt7601u_tx_queue *q,
+				  struct mt7601u_dma_buf_tx *e,
+				  void *data, int len, int n_frames)
 {
 	struct usb_device *usb_dev = mt7601u_to_usb_dev(dev);
-	unsigned snd_pipe = usb_sndbulkpipe(usb_dev, dev->out_eps[ep]);
-	struct mt7601u_dma_buf_tx *e;
-	struct mt7601u_tx_queue *q = &dev->tx_q[ep];
-	unsigned long flags;
+	unsigned snd_pipe = usb_sndbulkpipe(usb_dev,
+					    dev->out_eps[q - dev->tx_q]);
+	struct mt7601u_tx_aggr_stats *st = &dev->tx_aggr_stats;
 	int ret;
 
-	spin_lock_irqsave(&dev->tx_lock, flags);
-
-	if (WARN_ON(q->entries <= q->used)) {
-		ret = -ENOSPC;
-		goto out;
-	}
-
-	e = &q->e[q->end];
-	e->skb = skb;
-	usb_fill_bulk_urb(e->urb, usb_dev, snd_pipe, skb->data, skb->len,
+	usb_fill_bulk_urb(e->urb, usb_dev, snd_pipe, data, len,
 			  mt7601u_complete_tx, q);
+	e->submitted = ktime_get();
 	ret = usb_submit_urb(e->urb, GFP_ATOMIC);
 	if (ret) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_TX_SUBMIT_ERR);
 		/* Special-handle ENODEV from TX urb submission because it will
 		 * often be the first ENODEV we see after device is removed.
 		 */
@@ -256,14 +530,170 @@ static int mt7601u_dma_submit_tx(struct mt7601u_dev *dev,
 		else
 			dev_err(dev->dev, "Error: TX urb submit failed:%d\n",
 				ret);
-		goto out;
+		return ret;
 	}
 
 	q->end = (q->end + 1) % q->entries;
 	q->used++;
+	q->used_max = max(q->used_max, q->used);
+
+	st->urbs++;
+	st->frames += n_frames;
+	st->hist[min(n_frames, MT_TX_AGGR_MAX_FRAMES) - 1]++;
 
-	if (q->used >= q->entries)
+	return 0;
+}
+
+static int mt7601u_dma_submit_skb(struct mt7601u_dev *dev,
+				  struct mt7601u_tx_queue *q,
+				  struct sk_buff *skb)
+{
+	struct mt7601u_dma_buf_tx *e = &q->e[q->end];
+
+	if (WARN_ON(q->entries <= q->used))
+		return -ENOSPC;
+
+	e->skb = skb;
+	e->urb->transfer_flags &= ~URB_NO_TRANSFER_DMA_MAP;
+
+	return mt7601u_dma_submit_urb(dev, q, e, skb->data, skb->len, 1);
+}
+
+/* Note: frames are concatenated with their TXINFO headers and padding, only
+ *	 the 4 zero bytes which terminate each wrapped frame are dropped
+ *	 except for the last one (see mt7601u_dma_skb_wrap()).
+ *	 Must be called with tx_lock held.
+ */
+static void mt7601u_tx_aggr_flush(struct mt7601u_dev *dev,
+				  struct mt7601u_tx_queue *q)
+{
+	struct mt7601u_dma_buf_tx *e;
+	struct mt7601u_tx_aggr_buf *buf;
+	int n = skb_queue_len(&q->aggr_pending);
+	struct sk_buff *skb;
+	int b, len = 0;
+
+	if (!n || !q->e)
+		return;
+
+	hrtimer_try_to_cancel(&q->aggr_timer.timer);
+
+	b = find_first_bit(&q->aggr_buf_free, MT_TX_AGGR_BUFS);
+	if (n == 1 || b >= MT_TX_AGGR_BUFS || q->used >= q->entries ||
+	    q->aggr_len + 4 > MT_TX_AGGR_BUF_LEN) {
+		while ((skb = __skb_dequeue(&q->aggr_pending)))
+			if (mt7601u_dma_submit_skb(dev, q, skb)) {
+				q->bytes -= skb->len;
+				ieee80211_free_txskb(dev->hw, skb);
+			}
+		goto out;
+	}
+
+	e = &q->e[q->end];
+	buf = &q->aggr_bufs[b];
+	skb_queue_walk(&q->aggr_pending, skb) {
+		memcpy(buf->buf + len, skb->data, skb->len - 4);
+		len += skb->len - 4;
+	}
+	memset(buf->buf + len, 0, 4);
+	len += 4;
+
+	e->skb = NULL;
+	e->aggr_buf = b;
+	skb_queue_splice_init(&q->aggr_pending, &e->aggr);
+
+	e->urb->transfer_dma = buf->dma;
+	e->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+	if (mt7601u_dma_submit_urb(dev, q, e, buf->buf, len, n)) {
+		while ((skb = __skb_dequeue(&e->aggr))) {
+			q->bytes -= skb->len;
+			ieee80211_free_txskb(dev->hw, skb);
+		}
+		goto out;
+	}
+
+	clear_bit(b, &q->aggr_buf_free);
+out:
+	q->aggr_len = 0;
+}
+
+/* Must be called with tx_lock held */
+static void mt7601u_tx_ring_request(struct mt7601u_dev *dev,
+				    struct mt7601u_tx_queue *q)
+{
+	if (q->alloc_req)
+		return;
+
+	q->alloc_req = true;
+	queue_work(dev->stat_wq, &dev->tx_alloc_work);
+}
+
+static enum hrtimer_restart mt7601u_tx_aggr_timeout(struct hrtimer *timer)
+{
+	struct mt7601u_tx_queue *q = container_of(timer,
+						  struct mt7601u_tx_queue,
+						  aggr_timer.timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->dev->tx_lock, flags);
+	mt7601u_tx_aggr_flush(q->dev, q);
+	spin_unlock_irqrestore(&q->dev->tx_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Small frames are held back and packed together only while there are URBs
+ * in flight on the endpoint - the completion of those URBs will flush them.
+ * On an idle endpoint frames go out immediately and no latency is added.
+ */
+static int mt7601u_dma_submit_tx(struct mt7601u_dev *dev,
+				 struct sk_buff *skb, u8 ep)
+{
+	struct mt7601u_tx_queue *q = &dev->tx_q[ep];
+	unsigned long flags;
+	u32 aggr_max;
+	int ret = 0;
+
+	aggr_max = min_t(u32, READ_ONCE(dev->tx_aggr_max),
+			 MT_TX_AGGR_MAX_FRAMES);
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+
+	if (unlikely(!q->e))
+		mt7601u_tx_ring_request(dev, q);
+
+	if (!q->e ||
+	    (aggr_max > 1 && q->used && skb->len <= MT_TX_AGGR_FRAME_MAX_LEN)) {
+		if (q->aggr_len + skb->len > MT_TX_AGGR_BUF_LEN)
+			mt7601u_tx_aggr_flush(dev, q);
+
+		__skb_queue_tail(&q->aggr_pending, skb);
+		q->aggr_len += skb->len - 4;
+
+		if (skb_queue_len(&q->aggr_pending) >= aggr_max)
+			mt7601u_tx_aggr_flush(dev, q);
+		else if (skb_queue_len(&q->aggr_pending) == 1)
+			tasklet_hrtimer_start(&q->aggr_timer,
+					      ns_to_ktime(MT_TX_AGGR_TIMEOUT_US *
+							  NSEC_PER_USEC),
+					      HRTIMER_MODE_REL);
+	} else {
+		/* Keep frames in order */
+		mt7601u_tx_aggr_flush(dev, q);
+
+		ret = mt7601u_dma_submit_skb(dev, q, skb);
+		if (ret)
+			goto out;
+	}
+
+	q->bytes += skb->len;
+
+	if (q->used + skb_queue_len(&q->aggr_pending) >= q->entries &&
+	    !ieee80211_queue_stopped(dev->hw, skb_get_queue_mapping(skb))) {
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_TX_QUEUE_STOP);
 		ieee80211_stop_queue(dev->hw, skb_get_queue_mapping(skb));
+	}
 out:
 	spin_unlock_irqrestore(&dev->tx_lock, flags);
 
@@ -285,6 +715,39 @@ static enum mt76_qsel ep2dmaq(u8 ep)
 	return MT_QSEL_EDCA;
 }
 
+bool mt7601u_dma_tx_room(struct mt7601u_dev *dev, int hw_q)
+{
+	struct mt7601u_tx_queue *q = &dev->tx_q[q2ep(hw_q)];
+	unsigned long flags;
+	bool room;
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	if (unlikely(!q->e))
+		mt7601u_tx_ring_request(dev, q);
+	room = q->e && q->bytes < READ_ONCE(dev->tx_byte_limit) &&
+	       q->used + skb_queue_len(&q->aggr_pending) <
+	       q->entries - q->entries/8;
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	return room;
+}
+
+bool mt7601u_dma_tx_empty(struct mt7601u_dev *dev)
+{
+	unsigned long flags;
+	bool empty = true;
+	int i;
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	for (i = 0; i < __MT_EP_OUT_MAX; i++)
+		if (dev->tx_q[i].used ||
+		    !skb_queue_empty(&dev->tx_q[i].aggr_pending))
+			empty = false;
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	return empty;
+}
+
 int mt7601u_dma_enqueue_tx(struct mt7601u_dev *dev, struct sk_buff *skb,
 			   struct mt76_wcid *wcid, int hw_q)
 {
@@ -322,9 +785,7 @@ static int mt7601u_submit_rx(struct mt7601u_dev *dev)
 	int i, ret;
 
 	for (i = 0; i < dev->rx_q.entries; i++) {
-		ret = mt7601u_usb_submit_buf(dev, USB_DIR_IN, MT_EP_IN_PKT_RX,
-					     &dev->rx_q.e[i], GFP_KERNEL,
-					     mt7601u_complete_rx, dev);
+		ret = mt7601u_submit_rx_buf(dev, &dev->rx_q.e[i], GFP_KERNEL);
 		if (ret)
 			return ret;
 	}
@@ -336,8 +797,11 @@ static void mt7601u_free_rx(struct mt7601u_dev *dev)
 {
 	int i;
 
-	for (i = 0; i < dev->rx_q.entries; i++)
-		mt7601u_usb_free_buf(dev, &dev->rx_q.e[i]);
+	for (i = 0; i < dev->rx_q.entries; i++) {
+		if (dev->rx_q.e[i].p)
+			__free_pages(dev->rx_q.e[i].p, dev->rx_q.order);
+		usb_free_urb(dev->rx_q.e[i].urb);
+	}
 }
 
 static int mt7601u_alloc_rx(struct mt7601u_dev *dev)
@@ -346,75 +810,260 @@ static int mt7601u_alloc_rx(struct mt7601u_dev *dev)
 
 	memset(&dev->rx_q, 0, sizeof(dev->rx_q));
 	dev->rx_q.dev = dev;
-	dev->rx_q.entries = N_RX_ENTRIES;
+	dev->rx_q.entries = clamp_t(unsigned int, rx_urbs, 8, N_RX_ENTRIES);
+	dev->rx_q.order = mt7601u_rx_order();
+	dev->rx_q.budget = MT_RX_POLL_BUDGET;
 
-	for (i = 0; i < N_RX_ENTRIES; i++)
-		if (mt7601u_usb_alloc_buf(dev, MT_RX_URB_SIZE, &dev->rx_q.e[i]))
+	for (i = 0; i < dev->rx_q.entries; i++) {
+		dev->rx_q.e[i].urb = usb_alloc_urb(0, GFP_KERNEL);
+		dev->rx_q.e[i].p = dev_alloc_pages(dev->rx_q.order);
+
+		if (!dev->rx_q.e[i].urb || !dev->rx_q.e[i].p)
 			return -ENOMEM;
+	}
 
 	return 0;
 }
 
-static void mt7601u_free_tx_queue(struct mt7601u_tx_queue *q)
+void mt7601u_rx_aggr_init(struct mt7601u_dev *dev)
 {
+	struct mt7601u_rx_aggr *ra = &dev->rx_aggr;
+
+	/* Leave space for one more max-size frame after the limit is hit */
+	ra->lmt_max = min_t(u32, ((PAGE_SIZE << mt7601u_rx_order()) >> 10) - 3,
+			    0xff);
+	ra->lmt = min_t(u32, MT_USB_AGGR_SIZE_LIMIT, ra->lmt_max);
+	ra->tout = MT_USB_AGGR_TIMEOUT;
+}
+
+/* Note: bulk aggregation only pays off when there is more than one frame to
+ *	 put into an URB.  With light traffic use a short timeout and a small
+ *	 limit so that frames are not held back waiting for more, when the
+ *	 RX rate is high (or URBs keep filling up to the programmed limit)
+ *	 open the window.  The decision is based on bytes, not segments per
+ *	 URB - with a narrow window URBs never carry many segments.
+ */
+static void mt7601u_rx_aggr_adapt(struct mt7601u_rx_aggr *ra)
+{
+	u32 urbs = READ_ONCE(ra->urbs), bytes = READ_ONCE(ra->bytes);
+	u32 d_urbs = urbs - ra->last_urbs, d_bytes = bytes - ra->last_bytes;
+	bool full;
+
+	ra->last_urbs = urbs;
+	ra->last_bytes = bytes;
+
+	if (ra->manual)
+		return;
+
+	/* Average URB fill at least 3/4 of the limit */
+	full = d_urbs && d_bytes / d_urbs >= (ra->hw_lmt << 10) * 3 / 4;
+
+	if (d_bytes < MT_RX_AGGR_LIGHT_BYTES) {
+		ra->tout = MT_USB_AGGR_TIMEOUT_MIN;
+		ra->lmt = max_t(u32, ra->lmt_max / 4, 1);
+	} else if (d_bytes >= MT_RX_AGGR_BUSY_BYTES || full) {
+		ra->tout = MT_USB_AGGR_TIMEOUT_MAX;
+		ra->lmt = ra->lmt_max;
+	} else {
+		ra->tout = MT_USB_AGGR_TIMEOUT;
+		ra->lmt = min_t(u32, MT_USB_AGGR_SIZE_LIMIT, ra->lmt_max);
+	}
+}
+
+void mt7601u_rx_aggr_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       rx_aggr_work.work);
+	struct mt7601u_rx_aggr *ra = &dev->rx_aggr;
+	u32 tout, lmt;
+
+	/* Serialize with mt7601u_init_usb_dma() on resume */
+	mutex_lock(&dev->mutex);
+
+	mt7601u_rx_aggr_adapt(ra);
+
+	tout = min_t(u32, READ_ONCE(ra->tout), MT_USB_AGGR_TIMEOUT_MAX);
+	lmt = clamp_t(u32, READ_ONCE(ra->lmt), 1, ra->lmt_max);
+
+	if (tout != ra->hw_tout || lmt != ra->hw_lmt) {
+		mt7601u_rmw(dev, MT_USB_DMA_CFG,
+			    MT_USB_DMA_CFG_RX_BULK_AGG_TOUT |
+			    MT_USB_DMA_CFG_RX_BULK_AGG_LMT,
+			    MT76_SET(MT_USB_DMA_CFG_RX_BULK_AGG_TOUT, tout) |
+			    MT76_SET(MT_USB_DMA_CFG_RX_BULK_AGG_LMT, lmt));
+		ra->hw_tout = tout;
+		ra->hw_lmt = lmt;
+	}
+
+	mutex_unlock(&dev->mutex);
+
+	ieee80211_queue_delayed_work(dev->hw, &dev->rx_aggr_work,
+				     MT_RX_AGGR_INTERVAL);
+}
+
+static void mt7601u_tx_purge_pending(struct mt7601u_dev *dev,
+				     struct mt7601u_tx_queue *q)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(&q->aggr_pending))) {
+		q->bytes -= skb->len;
+		ieee80211_free_txskb(dev->hw, skb);
+	}
+	q->aggr_len = 0;
+}
+
+static void mt7601u_free_tx_queue(struct mt7601u_dev *dev,
+				  struct mt7601u_tx_queue *q)
+{
+	struct usb_device *usb_dev = mt7601u_to_usb_dev(dev);
 	int i;
 
+	tasklet_hrtimer_cancel(&q->aggr_timer);
+	mt7601u_tx_purge_pending(dev, q);
+
+	if (!q->e)
+		return;
+
 	WARN_ON(q->used);
 
 	for (i = 0; i < q->entries; i++)  {
 		usb_poison_urb(q->e[i].urb);
 		usb_free_urb(q->e[i].urb);
 	}
+	kfree(q->e);
+	q->e = NULL;
+
+	for (i = 0; i < MT_TX_AGGR_BUFS; i++)
+		if (q->aggr_bufs[i].buf)
+			usb_free_coherent(usb_dev, MT_TX_AGGR_BUF_LEN,
+					  q->aggr_bufs[i].buf,
+					  q->aggr_bufs[i].dma);
 }
 
 static void mt7601u_free_tx(struct mt7601u_dev *dev)
 {
 	int i;
 
+	if (!dev->tx_q)
+		return;
+
+	cancel_work_sync(&dev->tx_alloc_work);
+
 	for (i = 0; i < __MT_EP_OUT_MAX; i++)
-		mt7601u_free_tx_queue(&dev->tx_q[i]);
+		mt7601u_free_tx_queue(dev, &dev->tx_q[i]);
 }
 
-static int mt7601u_alloc_tx_queue(struct mt7601u_dev *dev,
-				  struct mt7601u_tx_queue *q)
+static int mt7601u_alloc_tx_ring(struct mt7601u_dev *dev,
+				 struct mt7601u_tx_queue *q)
 {
+	struct usb_device *usb_dev = mt7601u_to_usb_dev(dev);
+	struct mt7601u_dma_buf_tx *e;
+	unsigned long flags;
 	int i;
 
-	q->dev = dev;
-	q->entries = N_TX_ENTRIES;
+	e = kcalloc(q->entries, sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
 
-	for (i = 0; i < N_TX_ENTRIES; i++) {
-		q->e[i].urb = usb_alloc_urb(0, GFP_KERNEL);
-		if (!q->e[i].urb)
-			return -ENOMEM;
+	for (i = 0; i < q->entries; i++) {
+		__skb_queue_head_init(&e[i].aggr);
+		e[i].urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!e[i].urb)
+			goto err;
 	}
 
+	/* Note: ring is not published yet, nobody looks at aggr bufs.
+	 *	 Missing buffers only limit the aggregation.
+	 */
+	for (i = 0; i < MT_TX_AGGR_BUFS; i++) {
+		q->aggr_bufs[i].buf = usb_alloc_coherent(usb_dev,
+							 MT_TX_AGGR_BUF_LEN,
+							 GFP_KERNEL,
+							 &q->aggr_bufs[i].dma);
+		if (q->aggr_bufs[i].buf)
+			set_bit(i, &q->aggr_buf_free);
+	}
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	q->e = e;
+	mt7601u_tx_aggr_flush(dev, q);
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
 	return 0;
+err:
+	while (i--)
+		usb_free_urb(e[i].urb);
+	kfree(e);
+
+	return -ENOMEM;
 }
 
-static int mt7601u_alloc_tx(struct mt7601u_dev *dev)
+static void mt7601u_tx_alloc_work(struct work_struct *work)
 {
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       tx_alloc_work);
+	struct mt7601u_tx_queue *q;
+	unsigned long flags;
 	int i;
 
-	dev->tx_q = devm_kcalloc(dev->dev, __MT_EP_OUT_MAX,
-				 sizeof(*dev->tx_q), GFP_KERNEL);
+	for (i = 0; i < __MT_EP_OUT_MAX; i++) {
+		q = &dev->tx_q[i];
+		if (!q->alloc_req || q->e)
+			continue;
 
-	for (i = 0; i < __MT_EP_OUT_MAX; i++)
-		if (mt7601u_alloc_tx_queue(dev, &dev->tx_q[i]))
-			return -ENOMEM;
+		if (!mt7601u_alloc_tx_ring(dev, q))
+			continue;
 
-	return 0;
+		dev_err(dev->dev, "Error: TX ring %d allocation failed\n", i);
+
+		spin_lock_irqsave(&dev->tx_lock, flags);
+		mt7601u_tx_purge_pending(dev, q);
+		q->alloc_req = false;
+		spin_unlock_irqrestore(&dev->tx_lock, flags);
+	}
+
+	mt7601u_tx_kick(dev);
+}
+
+static void mt7601u_init_tx_queue(struct mt7601u_dev *dev,
+				  struct mt7601u_tx_queue *q, int ep)
+{
+	q->dev = dev;
+	q->entries = clamp_t(unsigned int, tx_ring_size[ep],
+			     MT_TX_RING_MIN, MT_TX_RING_MAX);
+
+	__skb_queue_head_init(&q->aggr_pending);
+	tasklet_hrtimer_init(&q->aggr_timer, mt7601u_tx_aggr_timeout,
+			     CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+}
+
+/* Note: rings hold no URBs until the endpoint is used for the first time,
+ *	 most of the endpoints never carry any traffic.  Queue structures are
+ *	 allocated once by mt7601u_alloc_device() and reset here, full
+ *	 re-init after resume goes through this again.
+ */
+static void mt7601u_init_tx(struct mt7601u_dev *dev)
+{
+	int i;
+
+	memset(dev->tx_q, 0, __MT_EP_OUT_MAX * sizeof(*dev->tx_q));
+
+	for (i = 0; i < __MT_EP_OUT_MAX; i++)
+		mt7601u_init_tx_queue(dev, &dev->tx_q[i], i);
 }
 
 int mt7601u_dma_init(struct mt7601u_dev *dev)
 {
 	int ret = -ENOMEM;
 
+	tasklet_init(&dev->tx_tasklet, mt7601u_tx_tasklet, (unsigned long) dev);
+	INIT_WORK(&dev->tx_work, mt7601u_tx_work);
+	INIT_WORK(&dev->tx_alloc_work, mt7601u_tx_alloc_work);
 	tasklet_init(&dev->rx_tasklet, mt7601u_rx_tasklet, (unsigned long) dev);
+	INIT_WORK(&dev->rx_work, mt7601u_rx_work);
 
-	ret = mt7601u_alloc_tx(dev);
-	if (ret)
-		goto err;
+	mt7601u_init_tx(dev);
 	ret = mt7601u_alloc_rx(dev);
 	if (ret)
 		goto err;
@@ -429,12 +1078,70 @@ err:
 	return ret;
 }
 
+/* Note: after poisoning all RX URBs complete with an error and the tasklet
+ *	 consumes them without resubmitting, the buffers stay allocated.
+ */
+void mt7601u_dma_suspend(struct mt7601u_dev *dev)
+{
+	mt7601u_kill_rx(dev);
+
+	tasklet_kill(&dev->rx_tasklet);
+	cancel_work_sync(&dev->rx_work);
+	tasklet_kill(&dev->tx_tasklet);
+	cancel_work_sync(&dev->tx_work);
+}
+
+int mt7601u_dma_resume(struct mt7601u_dev *dev)
+{
+	return mt7601u_dma_rx_resume(dev);
+}
+
+/* Note: used for dozing, unlike suspend what RX URBs had already received
+ *	 before being poisoned is delivered before returning.  Empty entries
+ *	 are consumed by the RX path without resubmitting.
+ */
+void mt7601u_dma_rx_pause(struct mt7601u_dev *dev)
+{
+	mt7601u_kill_rx(dev);
+
+	while (READ_ONCE(dev->rx_q.pending)) {
+		tasklet_kill(&dev->rx_tasklet);
+		flush_work(&dev->rx_work);
+	}
+}
+
+int mt7601u_dma_rx_resume(struct mt7601u_dev *dev)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&dev->rx_lock, flags);
+	dev->rx_q.start = 0;
+	dev->rx_q.end = 0;
+	dev->rx_q.pending = 0;
+	spin_unlock_irqrestore(&dev->rx_lock, flags);
+
+	for (i = 0; i < dev->rx_q.entries; i++) {
+		/* Time spent paused is not RX turnaround */
+		dev->rx_q.e[i].done = ktime_set(0, 0);
+		usb_unpoison_urb(dev->rx_q.e[i].urb);
+	}
+
+	return mt7601u_submit_rx(dev);
+}
+
 void mt7601u_dma_cleanup(struct mt7601u_dev *dev)
 {
 	mt7601u_kill_rx(dev);
 
 	tasklet_kill(&dev->rx_tasklet);
+	cancel_work_sync(&dev->rx_work);
 
 	mt7601u_free_rx(dev);
 	mt7601u_free_tx(dev);
+
+	tasklet_kill(&dev->tx_tasklet);
+	cancel_work_sync(&dev->tx_work);
+
+	mt7601u_tx_status_flush(dev);
 }
@@ -19,6 +19,35 @@
 #include <asm/unaligned.h>
 #include "mt7601u.h"
 #include "eeprom.h"
+#include "usb.h"
+
+#define MT_EE_CACHE_KEY_LEN	64
+#define MT_EE_CACHE_MAX		8
+#define MT_EE_CACHE_HEAD_LEN	16
+
+/**
+ * struct mt7601u_ee_cache - EEPROM contents of a device seen before
+ * @list:	entry on mt7601u_ee_cache_list.
+ * @key:	USB IDs and serial number (or topology if there is no serial).
+ * @image:	raw logical eFUSE image.
+ * @macaddr:	MAC address used, may be random if EEPROM has none.
+ * @params:	parameters parsed from @image.
+ *
+ * Reading the eFUSE takes a few USB transactions per 16 bytes.  The image
+ * can't change between probes of the same device so keep it (and what was
+ * parsed out of it) around until the module is unloaded.
+ */
+struct mt7601u_ee_cache {
+	struct list_head list;
+	char key[MT_EE_CACHE_KEY_LEN];
+	u8 image[MT7601U_EEPROM_SIZE];
+	u8 macaddr[ETH_ALEN];
+	struct mt7601u_eeprom_params params;
+};
+
+static LIST_HEAD(mt7601u_ee_cache_list);
+static DEFINE_MUTEX(mt7601u_ee_cache_mutex);
+static unsigned int mt7601u_ee_cache_len;
 
 static bool
 field_valid(u8 val)
@@ -148,11 +177,14 @@ mt7601u_set_macaddr(struct mt7601u_dev *dev, const u8 *eeprom)
 			 dev->macaddr);
 	}
 
+	return 0;
+}
+
+static void mt7601u_write_macaddr(struct mt7601u_dev *dev)
+{
 	mt76_wr(dev, MT_MAC_ADDR_DW0, get_unaligned_le32(dev->macaddr));
 	mt76_wr(dev, MT_MAC_ADDR_DW1, get_unaligned_le16(dev->macaddr + 4) |
 		MT76_SET(MT_MAC_ADDR_DW1_U2ME_MASK, 0xff));
-
-	return 0;
 }
 
 static void mt7601u_set_channel_target_power(struct mt7601u_dev *dev,
@@ -342,6 +374,17 @@ mt7601u_config_tx_power_per_rate(struct mt7601u_dev *dev, u8 *eeprom)
 		val = get_unaligned_le32(eeprom + MT_EE_TX_POWER_BYRATE(i));
 
 		mt7601u_save_power_rate(dev, bw40_delta, val, i);
+		dev->ee->tx_pwr_cfg[i] = val;
+	}
+}
+
+static void mt7601u_write_tx_power_per_rate(struct mt7601u_dev *dev)
+{
+	u32 val;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		val = dev->ee->tx_pwr_cfg[i];
 
 		if (~val)
 			mt7601u_wr(dev, MT_TX_PWR_CFG_0 + i * 4, val);
@@ -365,20 +408,153 @@ mt7601u_init_tssi_params(struct mt7601u_dev *dev, u8 *eeprom)
 	d->offset[2] = eeprom[MT_EE_TX_TSSI_OFFSET_GROUP + 2];
 }
 
-int
-mt7601u_eeprom_init(struct mt7601u_dev *dev)
+static void mt7601u_ee_cache_key(struct mt7601u_dev *dev, char *key, size_t len)
+{
+	struct usb_device *usb_dev = mt7601u_to_usb_dev(dev);
+
+	if (usb_dev->serial)
+		snprintf(key, len, "%04x:%04x-%s",
+			 le16_to_cpu(usb_dev->descriptor.idVendor),
+			 le16_to_cpu(usb_dev->descriptor.idProduct),
+			 usb_dev->serial);
+	else
+		snprintf(key, len, "%04x:%04x@%d-%s",
+			 le16_to_cpu(usb_dev->descriptor.idVendor),
+			 le16_to_cpu(usb_dev->descriptor.idProduct),
+			 usb_dev->bus->busnum, usb_dev->devpath);
+}
+
+static struct mt7601u_ee_cache *mt7601u_ee_cache_find(const char *key)
+{
+	struct mt7601u_ee_cache *c;
+
+	list_for_each_entry(c, &mt7601u_ee_cache_list, list)
+		if (!strcmp(c->key, key))
+			return c;
+
+	return NULL;
+}
+
+/* Note: the first block holds the chip ID, EEPROM version and the MAC
+ *	 address, if it still matches we can assume we are talking to the
+ *	 same chip and the rest of the image is the same too.
+ */
+static bool
+mt7601u_ee_cache_valid(struct mt7601u_dev *dev, const u8 *head)
+{
+	u8 data[MT_EE_CACHE_HEAD_LEN];
+
+	if (mt7601u_efuse_read(dev, 0, data, MT_EE_READ))
+		return false;
+
+	return !memcmp(data, head, sizeof(data));
+}
+
+static void mt7601u_ee_cache_store(struct mt7601u_dev *dev, const char *key,
+				   const u8 *eeprom)
+{
+	struct mt7601u_ee_cache *c;
+
+	c = mt7601u_ee_cache_find(key);
+	if (!c) {
+		if (mt7601u_ee_cache_len >= MT_EE_CACHE_MAX) {
+			c = list_last_entry(&mt7601u_ee_cache_list,
+					    struct mt7601u_ee_cache, list);
+			list_del(&c->list);
+		} else {
+			c = kzalloc(sizeof(*c), GFP_KERNEL);
+			if (!c)
+				return;
+			mt7601u_ee_cache_len++;
+		}
+		strlcpy(c->key, key, sizeof(c->key));
+	} else {
+		list_del(&c->list);
+	}
+
+	memcpy(c->image, eeprom, MT7601U_EEPROM_SIZE);
+	memcpy(c->macaddr, dev->macaddr, ETH_ALEN);
+	c->params = *dev->ee;
+	list_add(&c->list, &mt7601u_ee_cache_list);
+}
+
+void mt7601u_eeprom_cache_free(void)
+{
+	struct mt7601u_ee_cache *c, *tmp;
+
+	mutex_lock(&mt7601u_ee_cache_mutex);
+	list_for_each_entry_safe(c, tmp, &mt7601u_ee_cache_list, list) {
+		list_del(&c->list);
+		kfree(c);
+	}
+	mt7601u_ee_cache_len = 0;
+	mutex_unlock(&mt7601u_ee_cache_mutex);
+}
+
+static void
+mt7601u_eeprom_print_ver(struct mt7601u_dev *dev, const u8 *eeprom)
 {
+	if (eeprom[MT_EE_VERSION_EE] > MT7601U_EE_MAX_VER)
+		dev_warn(dev->dev,
+			 "Warning: unsupported EEPROM version %02hhx\n",
+			 eeprom[MT_EE_VERSION_EE]);
+	dev_info(dev->dev, "EEPROM ver:%02hhx fae:%02hhx\n",
+		 eeprom[MT_EE_VERSION_EE], eeprom[MT_EE_VERSION_FAE]);
+}
+
+/* Note: cache mutex is global, hold it only to copy the entry out so that
+ *	 probes of other devices don't wait for our USB I/O.
+ */
+static bool mt7601u_eeprom_init_cached(struct mt7601u_dev *dev,
+				       const char *key)
+{
+	u8 head[MT_EE_CACHE_HEAD_LEN];
+	struct mt7601u_ee_cache *c;
+
+	mutex_lock(&mt7601u_ee_cache_mutex);
+	c = mt7601u_ee_cache_find(key);
+	if (!c) {
+		mutex_unlock(&mt7601u_ee_cache_mutex);
+		return false;
+	}
+
+	memcpy(head, c->image, sizeof(head));
+	memcpy(dev->macaddr, c->macaddr, ETH_ALEN);
+	*dev->ee = c->params;
+
+	/* Keep most recently used entries at the front */
+	list_move(&c->list, &mt7601u_ee_cache_list);
+	mutex_unlock(&mt7601u_ee_cache_mutex);
+
+	if (!mt7601u_ee_cache_valid(dev, head)) {
+		dev_dbg(dev->dev, "EEPROM changed, dropping cached copy\n");
+		memset(dev->ee, 0, sizeof(*dev->ee));
+		return false;
+	}
+
+	mt7601u_eeprom_print_ver(dev, head);
+
+	mt7601u_write_macaddr(dev);
+	mt7601u_write_tx_power_per_rate(dev);
+
+	return true;
+}
+
+static int mt7601u_eeprom_load(struct mt7601u_dev *dev)
+{
+	char key[MT_EE_CACHE_KEY_LEN];
 	u8 *eeprom;
 	int i, ret;
 
+	mt7601u_ee_cache_key(dev, key, sizeof(key));
+
+	if (mt7601u_eeprom_init_cached(dev, key))
+		return 0;
+
 	ret = mt7601u_efuse_physical_size_check(dev);
 	if (ret)
 		return ret;
 
-	dev->ee = devm_kzalloc(dev->dev, sizeof(*dev->ee), GFP_KERNEL);
-	if (!dev->ee)
-		return -ENOMEM;
-
 	eeprom = kmalloc(MT7601U_EEPROM_SIZE, GFP_KERNEL);
 	if (!eeprom)
 		return -ENOMEM;
@@ -389,14 +565,10 @@ mt7601u_eeprom_init(struct mt7601u_dev *dev)
 			goto out;
 	}
 
-	if (eeprom[MT_EE_VERSION_EE] > MT7601U_EE_MAX_VER)
-		dev_warn(dev->dev,
-			 "Warning: unsupported EEPROM version %02hhx\n",
-			 eeprom[MT_EE_VERSION_EE]);
-	dev_info(dev->dev, "EEPROM ver:%02hhx fae:%02hhx\n",
-		 eeprom[MT_EE_VERSION_EE], eeprom[MT_EE_VERSION_FAE]);
+	mt7601u_eeprom_print_ver(dev, eeprom);
 
 	mt7601u_set_macaddr(dev, eeprom);
+	mt7601u_write_macaddr(dev);
 	mt7601u_set_chip_cap(dev, eeprom);
 	mt7601u_set_channel_power(dev, eeprom);
 	mt7601u_set_country_reg(dev, eeprom);
@@ -406,9 +578,40 @@ mt7601u_eeprom_init(struct mt7601u_dev *dev)
 	dev->ee->lna_gain = eeprom[MT_EE_LNA_GAIN];
 
 	mt7601u_config_tx_power_per_rate(dev, eeprom);
+	mt7601u_write_tx_power_per_rate(dev);
 
 	mt7601u_init_tssi_params(dev, eeprom);
+
+	mutex_lock(&mt7601u_ee_cache_mutex);
+	mt7601u_ee_cache_store(dev, key, eeprom);
+	mutex_unlock(&mt7601u_ee_cache_mutex);
 out:
 	kfree(eeprom);
 	return ret;
 }
+
+int mt7601u_eeprom_init(struct mt7601u_dev *dev)
+{
+	int ret;
+
+	/* Already parsed by early init or before a reset, @ee may be in use,
+	 * only program what the chip has lost.
+	 */
+	if (dev->ee) {
+		mt7601u_write_macaddr(dev);
+		mt7601u_write_tx_power_per_rate(dev);
+		return 0;
+	}
+
+	dev->ee = devm_kzalloc(dev->dev, sizeof(*dev->ee), GFP_KERNEL);
+	if (!dev->ee)
+		return -ENOMEM;
+
+	ret = mt7601u_eeprom_load(dev);
+	if (ret) {
+		devm_kfree(dev->dev, dev->ee);
+		dev->ee = NULL;
+	}
+
+	return ret;
+}
@@ -107,6 +107,7 @@ struct mt7601u_eeprom_params {
 
 	u8 chan_pwr[14];
 	struct mt7601u_rate_power power_rate_table;
+	u32 tx_pwr_cfg[5];
 	s8 real_cck_bw20[2];
 
 	/* TSSI stuff - only with internal TX ALC */
@@ -120,6 +121,7 @@ struct mt7601u_eeprom_params {
 };
 
 int mt7601u_eeprom_init(struct mt7601u_dev *dev);
+void mt7601u_eeprom_cache_free(void);
 
 static inline u32 s6_validate(u32 reg)
 {
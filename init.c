@@ -17,6 +17,7 @@
 #include "eeprom.h"
 #include "trace.h"
 #include "mcu.h"
+#include "usb.h"
 
 #include "initvals.h"
 
@@ -102,14 +103,22 @@ static void mt7601u_reset_csr_bbp(struct mt7601u_dev *dev)
 	mt7601u_wr(dev, MT_USB_DMA_CFG, 0);
 	msleep(1);
 	mt7601u_wr(dev, MT_MAC_SYS_CTRL, 0);
+
+	mt7601u_phy_shadow_reset(dev);
 }
 
+/* Note: caller must hold dev->mutex, mt7601u_rx_aggr_work() modifies
+ *	 MT_USB_DMA_CFG too.
+ */
 static void mt7601u_init_usb_dma(struct mt7601u_dev *dev)
 {
 	u32 val;
 
-	val = MT76_SET(MT_USB_DMA_CFG_RX_BULK_AGG_TOUT, MT_USB_AGGR_TIMEOUT) |
-	      MT76_SET(MT_USB_DMA_CFG_RX_BULK_AGG_LMT, MT_USB_AGGR_SIZE_LIMIT) |
+	dev->rx_aggr.hw_tout = dev->rx_aggr.tout;
+	dev->rx_aggr.hw_lmt = dev->rx_aggr.lmt;
+
+	val = MT76_SET(MT_USB_DMA_CFG_RX_BULK_AGG_TOUT, dev->rx_aggr.hw_tout) |
+	      MT76_SET(MT_USB_DMA_CFG_RX_BULK_AGG_LMT, dev->rx_aggr.hw_lmt) |
 	      MT_USB_DMA_CFG_RX_BULK_EN |
 	      MT_USB_DMA_CFG_TX_BULK_EN;
 	if (dev->in_max_packet == 512)
@@ -124,23 +133,21 @@ static void mt7601u_init_usb_dma(struct mt7601u_dev *dev)
 
 static int mt7601u_init_bbp(struct mt7601u_dev *dev)
 {
+	static const struct mt7601u_reg_prog prog[] = {
+		MT_REG_PROG(MT_MCU_MEMMAP_BBP, bbp_common_vals),
+		MT_REG_PROG(MT_MCU_MEMMAP_BBP, bbp_chip_vals),
+	};
 	int ret;
 
 	ret = mt7601u_wait_bbp_ready(dev);
 	if (ret)
 		return ret;
 
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_BBP, bbp_common_vals,
-				      ARRAY_SIZE(bbp_common_vals));
-	if (ret)
-		return ret;
-
-	return mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_BBP, bbp_chip_vals,
-				       ARRAY_SIZE(bbp_chip_vals));
+	return mt7601u_write_reg_prog(dev, prog, ARRAY_SIZE(prog));
 }
 
 static void
-mt76_init_beacon_offsets(struct mt7601u_dev *dev)
+mt76_init_beacon_offsets(struct mt7601u_dev *dev, struct mt7601u_reg_batch *b)
 {
 	u16 base = MT_BEACON_BASE;
 	u32 regs[4] = {};
@@ -153,27 +160,27 @@ mt76_init_beacon_offsets(struct mt7601u_dev *dev)
 	}
 
 	for (i = 0; i < 4; i++)
-		mt7601u_wr(dev, MT_BCN_OFFSET(i), regs[i]);
+		mt7601u_batch_wr(b, MT_BCN_OFFSET(i), regs[i]);
 }
 
 static int mt7601u_write_mac_initvals(struct mt7601u_dev *dev)
 {
+	static const struct mt7601u_reg_prog prog[] = {
+		MT_REG_PROG(MT_MCU_MEMMAP_WLAN, mac_common_vals),
+		MT_REG_PROG(MT_MCU_MEMMAP_WLAN, mac_chip_vals),
+	};
+	struct mt7601u_reg_batch b;
 	int ret;
 
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_WLAN, mac_common_vals,
-				      ARRAY_SIZE(mac_common_vals));
-	if (ret)
-		return ret;
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_WLAN,
-				      mac_chip_vals, ARRAY_SIZE(mac_chip_vals));
+	ret = mt7601u_write_reg_prog(dev, prog, ARRAY_SIZE(prog));
 	if (ret)
 		return ret;
 
-	mt76_init_beacon_offsets(dev);
+	mt7601u_batch_init(dev, &b);
+	mt76_init_beacon_offsets(dev, &b);
+	mt7601u_batch_wr(&b, MT_AUX_CLK_CFG, 0);
 
-	mt7601u_wr(dev, MT_AUX_CLK_CFG, 0);
-
-	return 0;
+	return mt7601u_batch_commit(&b);
 }
 
 static int mt7601u_init_wcid_mem(struct mt7601u_dev *dev)
@@ -314,6 +321,7 @@ void mt7601u_mac_stop(struct mt7601u_dev *dev)
 	mt7601u_mac_stop_hw(dev);
 	flush_delayed_work(&dev->stat_work);
 	cancel_delayed_work_sync(&dev->stat_work);
+	mt7601u_tx_status_flush(dev);
 }
 
 static void mt7601u_stop_hardware(struct mt7601u_dev *dev)
@@ -321,6 +329,25 @@ static void mt7601u_stop_hardware(struct mt7601u_dev *dev)
 	mt7601u_chip_onoff(dev, false, false);
 }
 
+static int mt7601u_init_mac_misc(struct mt7601u_dev *dev)
+{
+	struct mt7601u_reg_batch b;
+
+	mt7601u_batch_init(dev, &b);
+
+	mt7601u_batch_rmw(&b, MT_BEACON_TIME_CFG,
+			  MT_BEACON_TIME_CFG_TIMER_EN |
+			  MT_BEACON_TIME_CFG_SYNC_MODE |
+			  MT_BEACON_TIME_CFG_TBTT_EN |
+			  MT_BEACON_TIME_CFG_BEACON_TX, 0);
+	mt7601u_batch_rmw(&b, MT_US_CYC_CFG, MT_US_CYC_CNT, 0x1e);
+	mt7601u_batch_wr(&b, MT_TXOP_CTRL_CFG,
+			 MT76_SET(MT_TXOP_TRUN_EN, 0x3f) |
+			 MT76_SET(MT_TXOP_EXT_CCA_DLY, 0x58));
+
+	return mt7601u_batch_commit(&b);
+}
+
 int mt7601u_init_hardware(struct mt7601u_dev *dev)
 {
 	static const u16 beacon_offsets[16] = {
@@ -387,18 +414,12 @@ int mt7601u_init_hardware(struct mt7601u_dev *dev)
 	if (ret)
 		goto err_rx;
 
-	mt76_clear(dev, MT_BEACON_TIME_CFG, (MT_BEACON_TIME_CFG_TIMER_EN |
-					     MT_BEACON_TIME_CFG_SYNC_MODE |
-					     MT_BEACON_TIME_CFG_TBTT_EN |
-					     MT_BEACON_TIME_CFG_BEACON_TX));
+	ret = mt7601u_init_mac_misc(dev);
+	if (ret)
+		goto err_rx;
 
 	mt7601u_reset_counters(dev);
 
-	mt7601u_rmw(dev, MT_US_CYC_CFG, MT_US_CYC_CNT, 0x1e);
-
-	mt7601u_wr(dev, MT_TXOP_CTRL_CFG, MT76_SET(MT_TXOP_TRUN_EN, 0x3f) |
-					  MT76_SET(MT_TXOP_EXT_CCA_DLY, 0x58));
-
 	ret = mt7601u_eeprom_init(dev);
 	if (ret)
 		goto err_rx;
@@ -425,6 +446,42 @@ err:
 	return ret;
 }
 
+/* Note: bare minimum needed to register with mac80211 - EEPROM (MAC address,
+ *	 channels, power).  Everything it programs into the chip is reset and
+ *	 written again by mt7601u_init_hardware() from the parsed copy.
+ */
+int mt7601u_init_early(struct mt7601u_dev *dev)
+{
+	int ret;
+
+	mt7601u_chip_onoff(dev, true, false);
+
+	ret = mt7601u_wait_asic_ready(dev);
+	if (ret)
+		return ret;
+
+	return mt7601u_eeprom_init(dev);
+}
+
+void mt7601u_init_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       init_work);
+	int ret;
+
+	mutex_lock(&dev->mutex);
+	ret = mt7601u_init_hardware(dev);
+	if (ret) {
+		dev_err(dev->dev, "Error: deferred init failed: %d\n", ret);
+	} else {
+		set_bit(MT7601U_STATE_INITIALIZED, &dev->state);
+		mt7601u_init_debugfs(dev);
+	}
+	mutex_unlock(&dev->mutex);
+
+	complete_all(&dev->init_done);
+}
+
 void mt7601u_cleanup(struct mt7601u_dev *dev)
 {
 	mt7601u_stop_hardware(dev);
@@ -432,10 +489,137 @@ void mt7601u_cleanup(struct mt7601u_dev *dev)
 	mt7601u_mcu_cmd_deinit(dev);
 }
 
+static bool fast_resume = true;
+module_param(fast_resume, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fast_resume,
+		 "keep the chip powered over suspend and skip full re-init");
+
+/* Registers initialized by the driver or holding calibration results which
+ * are not reprogrammed by mac80211 on resume.  Runs of consecutive registers
+ * are written with burst commands.  MAC address has to stay first, see
+ * mt7601u_fast_resume().
+ */
+static const u32 mt7601u_pm_mac_regs[] = {
+	MT_MAC_ADDR_DW0,
+	MT_MAC_ADDR_DW1,
+	MT_MAC_BSSID_DW0,
+	MT_MAC_BSSID_DW1,
+	MT_TX_PWR_CFG_0,
+	MT_TX_PWR_CFG_1,
+	MT_TX_PWR_CFG_2,
+	MT_TX_PWR_CFG_3,
+	MT_TX_PWR_CFG_4,
+	MT_TXOP_CTRL_CFG,
+	MT_TX_ALC_CFG_2,
+	MT_TX_ALC_CFG_0,
+	MT_TX_ALC_CFG_1,
+	MT_TX_ALC_VGA3,
+	MT_TX_PWR_CFG_7,
+	MT_TX_PWR_CFG_8,
+	MT_TX_PWR_CFG_9,
+	MT_RX_FILTR_CFG,
+	MT_LEGACY_BASIC_RATE,
+	MT_HT_BASIC_RATE,
+	MT_US_CYC_CFG,
+};
+
+/* Note: mac80211 has already stopped the device (and with it MAC TX/RX) by
+ *	 the time we get here.  In light mode the chip is left powered, RX
+ *	 URBs are only killed and the state which mac80211 does not restore
+ *	 is saved.  If the device turns out to have lost power on resume we
+ *	 fall back to full re-init.
+ */
+void mt7601u_suspend_hw(struct mt7601u_dev *dev)
+{
+	struct mt7601u_pm_state *pm = &dev->pm;
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(mt7601u_pm_mac_regs) != MT_PM_MAC_REGS);
+
+	pm->light = fast_resume;
+	if (!pm->light) {
+		clear_bit(MT7601U_STATE_INITIALIZED, &dev->state);
+		mt7601u_cleanup(dev);
+		clear_bit(MT7601U_STATE_MCU_RUNNING, &dev->state);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mt7601u_pm_mac_regs); i++)
+		pm->mac[i] = mt7601u_rr(dev, mt7601u_pm_mac_regs[i]);
+	mt7601u_phy_pm_save(dev);
+
+	mt7601u_dma_suspend(dev);
+	mt7601u_mcu_cmd_suspend(dev);
+}
+
+static int mt7601u_fast_resume(struct mt7601u_dev *dev)
+{
+	struct mt7601u_pm_state *pm = &dev->pm;
+	struct mt7601u_reg_batch b;
+	int i, ret;
+
+	/* MAC address is non-zero and set by us, if it's gone so is the rest */
+	if (mt7601u_rr(dev, MT_MAC_ADDR_DW0) != pm->mac[0])
+		return -ENODEV;
+
+	ret = mt7601u_mcu_cmd_resume(dev);
+	if (ret)
+		return ret;
+
+	mt7601u_init_usb_dma(dev);
+
+	mt7601u_batch_init(dev, &b);
+	for (i = 0; i < ARRAY_SIZE(mt7601u_pm_mac_regs); i++)
+		mt7601u_batch_wr(&b, mt7601u_pm_mac_regs[i], pm->mac[i]);
+	mt7601u_phy_pm_restore(dev, &b);
+	ret = mt7601u_batch_commit(&b);
+	if (ret)
+		return ret;
+
+	return mt7601u_dma_resume(dev);
+}
+
+int mt7601u_resume_hw(struct mt7601u_dev *dev, bool reset)
+{
+	struct mt7601u_pm_state *pm = &dev->pm;
+	int ret;
+
+	mutex_lock(&dev->mutex);
+
+	mt7601u_phy_shadow_reset(dev);
+
+	if (pm->light) {
+		pm->light = false;
+
+		ret = reset ? -ENODEV : mt7601u_fast_resume(dev);
+		if (!ret)
+			goto out;
+
+		dev_info(dev->dev, "Device lost state, doing full re-init\n");
+		clear_bit(MT7601U_STATE_INITIALIZED, &dev->state);
+		mt7601u_cleanup(dev);
+		clear_bit(MT7601U_STATE_MCU_RUNNING, &dev->state);
+	}
+
+	ret = mt7601u_init_hardware(dev);
+	if (!ret)
+		set_bit(MT7601U_STATE_INITIALIZED, &dev->state);
+out:
+	mutex_unlock(&dev->mutex);
+
+	return ret;
+}
+
+static bool threaded_io;
+module_param(threaded_io, bool, S_IRUGO);
+MODULE_PARM_DESC(threaded_io,
+		 "run RX and TX scheduling from a per-device workqueue instead of tasklets");
+
 struct mt7601u_dev *mt7601u_alloc_device(struct device *pdev)
 {
 	struct ieee80211_hw *hw;
 	struct mt7601u_dev *dev;
+	int i, cpu;
 
 	hw = ieee80211_alloc_hw(sizeof(*dev), &mt7601u_ops);
 	if (!hw)
@@ -451,16 +635,59 @@ struct mt7601u_dev *mt7601u_alloc_device(struct device *pdev)
 	spin_lock_init(&dev->tx_lock);
 	spin_lock_init(&dev->rx_lock);
 	spin_lock_init(&dev->lock);
-	spin_lock_init(&dev->con_mon_lock);
+	spin_lock_init(&dev->txq_lock);
+	INIT_WORK(&dev->init_work, mt7601u_init_work);
+	spin_lock_init(&dev->prof.lock);
+	init_completion(&dev->init_done);
+	for (i = 0; i < ARRAY_SIZE(dev->txq_list); i++)
+		INIT_LIST_HEAD(&dev->txq_list[i]);
+	dev->tx_byte_limit = MT_TX_BYTE_LIMIT;
+	dev->tx_aggr_max = MT_TX_AGGR_MAX_FRAMES;
+	dev->mac_work_ms = MT_MAC_WORK_MS;
+	mt7601u_rx_aggr_init(dev);
+	__skb_queue_head_init(&dev->tx_pending);
 	atomic_set(&dev->avg_ampdu_len, 1);
+	atomic_set(&dev->bcn_mon, MT76_SET(MT_BCN_MON_FREQ_OFF,
+					   MT_FREQ_OFFSET_INVALID));
 
-	dev->stat_wq = alloc_workqueue("mt7601u", WQ_UNBOUND, 0);
-	if (!dev->stat_wq) {
+	dev->tx_q = devm_kcalloc(pdev, __MT_EP_OUT_MAX, sizeof(*dev->tx_q),
+				 GFP_KERNEL);
+	dev->vend_buf = devm_kmalloc(pdev, sizeof(*dev->vend_buf), GFP_KERNEL);
+	if (!dev->tx_q || !dev->vend_buf) {
 		ieee80211_free_hw(hw);
 		return NULL;
 	}
 
+	dev->sw_stats = alloc_percpu(struct mt7601u_sw_stats);
+	if (!dev->sw_stats) {
+		ieee80211_free_hw(hw);
+		return NULL;
+	}
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(dev->sw_stats, cpu)->syncp);
+
+	dev->stat_wq = alloc_workqueue("mt7601u-%s",
+				       WQ_UNBOUND | WQ_HIGHPRI | WQ_SYSFS, 0,
+				       dev_name(pdev));
+	if (!dev->stat_wq)
+		goto err_stats;
+
+	if (threaded_io) {
+		dev->io_wq = alloc_workqueue("mt7601u-io-%s",
+					     WQ_UNBOUND | WQ_HIGHPRI | WQ_SYSFS,
+					     0, dev_name(pdev));
+		if (!dev->io_wq)
+			goto err_stat_wq;
+	}
+
 	return dev;
+
+err_stat_wq:
+	destroy_workqueue(dev->stat_wq);
+err_stats:
+	free_percpu(dev->sw_stats);
+	ieee80211_free_hw(hw);
+	return NULL;
 }
 
 #define CHAN2G(_idx, _freq) {			\
@@ -585,12 +812,13 @@ int mt7601u_register_device(struct mt7601u_dev *dev)
 				     GFP_KERNEL);
 	if (!dev->mon_wcid)
 		return -ENOMEM;
-	dev->mon_wcid->idx = 0xff;
-	dev->mon_wcid->hw_key_idx = -1;
+	mt76_mac_wcid_init(dev->mon_wcid, 0xff);
 
 	SET_IEEE80211_DEV(hw, dev->dev);
 
 	hw->queues = 4;
+	/* TXWI, DMA header and worst case 802.11 header padding */
+	hw->extra_tx_headroom = sizeof(struct mt76_txwi) + 4 + 2;
 	hw->flags = IEEE80211_HW_SIGNAL_DBM |
 		    IEEE80211_HW_PS_NULLFUNC_STACK |
 		    IEEE80211_HW_SUPPORTS_HT_CCK_RATES |
@@ -605,24 +833,25 @@ int mt7601u_register_device(struct mt7601u_dev *dev)
 
 	hw->sta_data_size = sizeof(struct mt76_sta);
 	hw->vif_data_size = sizeof(struct mt76_vif);
+	hw->txq_data_size = sizeof(struct mt76_txq);
 
 	SET_IEEE80211_PERM_ADDR(hw, dev->macaddr);
 
 	wiphy->features |= NL80211_FEATURE_ACTIVE_MONITOR;
 	wiphy->interface_modes = BIT(NL80211_IFTYPE_STATION);
 
+	wiphy->max_scan_ssids = MT_SCAN_MAX_SSIDS;
+	wiphy->max_scan_ie_len = MT_SCAN_MAX_IE_LEN;
+
 	ret = mt76_init_sband_2g(dev);
 	if (ret)
 		return ret;
 
 	INIT_DELAYED_WORK(&dev->mac_work, mt7601u_mac_work);
+	INIT_DELAYED_WORK(&dev->rx_aggr_work, mt7601u_rx_aggr_work);
+	INIT_DELAYED_WORK(&dev->scan.work, mt7601u_scan_work);
 	INIT_DELAYED_WORK(&dev->stat_work, mt7601u_tx_stat);
+	mt7601u_ps_init(dev);
 
-	ret = ieee80211_register_hw(hw);
-	if (ret)
-		return ret;
-
-	mt7601u_init_debugfs(dev);
-
-	return 0;
+	return ieee80211_register_hw(hw);
 }
@@ -139,23 +139,159 @@ u16 mt76_mac_tx_rate_val(struct mt7601u_dev *dev,
 	return rateval;
 }
 
+void mt76_mac_wcid_init(struct mt76_wcid *wcid, u8 idx)
+{
+	memset(wcid, 0, sizeof(*wcid));
+	wcid->idx = idx;
+	wcid->hw_key_idx = -1;
+	seqcount_init(&wcid->tmpl_seq);
+}
+
 void mt76_mac_wcid_set_rate(struct mt7601u_dev *dev, struct mt76_wcid *wcid,
 			    const struct ieee80211_tx_rate *rate)
 {
 	unsigned long flags;
+	u16 rate_ctl;
+	u8 nss;
+
+	rate_ctl = mt76_mac_tx_rate_val(dev, rate, &nss);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	write_seqcount_begin(&wcid->tmpl_seq);
+	wcid->tmpl.rate_ctl = rate_ctl;
+	wcid->tmpl.rate_nss = nss;
+	wcid->tmpl.rate_set = true;
+	write_seqcount_end(&wcid->tmpl_seq);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+/* Must be called with dev->lock held */
+static void mt7601u_mac_ampdu_apply(struct mt76_sta *msta)
+{
+	struct mt76_wcid *wcid = &msta->wcid;
+
+	write_seqcount_begin(&wcid->tmpl_seq);
+	wcid->tmpl.ba_size = msta->ampdu.ba_size;
+	wcid->tmpl.density = msta->ampdu.density;
+	write_seqcount_end(&wcid->tmpl_seq);
+}
+
+/* Note: MT_MAX_LEN_CFG limits length of aggregates to all peers, so it is
+ *	 set to the largest factor of all stations.  Windows of stations which
+ *	 can take less are bounded by the number of full size data
+ *	 subframes (A-MSDUs are not sent) fitting in their maximum A-MPDU
+ *	 length instead.
+ */
+static u8 mt7601u_mac_ampdu_cap(u8 peer_factor, u8 hw_factor)
+{
+	u32 cap = IEEE80211_MIN_AMPDU_BUF << peer_factor;
+
+	if (peer_factor < hw_factor)
+		cap = min_t(u32, cap,
+			    ((1 << (IEEE80211_HT_MAX_AMPDU_FACTOR +
+				    peer_factor)) - 1) /
+			    MT_AMPDU_CTL_SUBFRAME_LEN);
+
+	return min_t(u32, cap, 63);
+}
+
+void mt7601u_mac_ampdu_ctl_init(struct mt7601u_dev *dev, struct mt76_sta *msta,
+				struct ieee80211_sta *sta)
+{
+	struct mt7601u_ampdu_ctl *ctl = &msta->ampdu;
+	unsigned long flags;
+
+	atomic_set(&ctl->tx, 0);
+	atomic_set(&ctl->retry, 0);
+	atomic_set(&ctl->fail, 0);
 
 	spin_lock_irqsave(&dev->lock, flags);
-	wcid->tx_rate = mt76_mac_tx_rate_val(dev, rate, &wcid->tx_rate_nss);
-	wcid->tx_rate_set = true;
+	ctl->ba_cap = mt7601u_mac_ampdu_cap(sta->ht_cap.ampdu_factor,
+					    dev->ampdu_factor);
+	ctl->ba_size = ctl->ba_cap;
+	ctl->density_min = sta->ht_cap.ampdu_density;
+	ctl->density = ctl->density_min;
+	ctl->bad_pct = 0;
+	mt7601u_mac_ampdu_apply(msta);
 	spin_unlock_irqrestore(&dev->lock, flags);
 }
 
-struct mt76_tx_status mt7601u_mac_fetch_tx_status(struct mt7601u_dev *dev)
+static void
+mt7601u_mac_ampdu_feedback(struct mt76_sta *msta, struct mt76_tx_status *stat)
+{
+	struct mt7601u_ampdu_ctl *ctl = &msta->ampdu;
+
+	if (!stat->aggr || !stat->ack_req)
+		return;
+
+	atomic_inc(&ctl->tx);
+	atomic_add(stat->retry, &ctl->retry);
+	if (!stat->success)
+		atomic_inc(&ctl->fail);
+}
+
+/* Note: links with many retries or failures get their window halved and
+ *	 MPDU spacing increased, clean links grow the window back up to
+ *	 the cap.  Density is only relaxed towards the peer's minimum when
+ *	 HW actually had to pad with zero length delimiters.  TX underflows
+ *	 mean USB can't keep up with long aggregates, back off all links.
+ */
+static void mt7601u_mac_ampdu_ctl_step(struct mt7601u_dev *dev, u32 underflow,
+				       u32 zero_len_del)
+{
+	struct mt7601u_ampdu_ctl *ctl;
+	struct mt76_wcid *wcid;
+	struct mt76_sta *msta;
+	unsigned long flags;
+	u32 tx, retry, fail;
+	int i;
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(dev->wcid); i++) {
+		wcid = rcu_dereference(dev->wcid[i]);
+		if (!wcid)
+			continue;
+
+		msta = container_of(wcid, struct mt76_sta, wcid);
+		ctl = &msta->ampdu;
+
+		if (atomic_read(&ctl->tx) < MT_AMPDU_CTL_MIN_SAMPLES &&
+		    !underflow)
+			continue;
+
+		tx = atomic_xchg(&ctl->tx, 0);
+		retry = atomic_xchg(&ctl->retry, 0);
+		fail = atomic_xchg(&ctl->fail, 0);
+
+		spin_lock_irqsave(&dev->lock, flags);
+		ctl->bad_pct = tx ? min_t(u32, 100, (retry + fail) * 100 / tx) :
+				    0;
+
+		if (underflow || ctl->bad_pct > MT_AMPDU_CTL_BAD_PCT) {
+			ctl->ba_size = max_t(u8, ctl->ba_size / 2,
+					     MT_AMPDU_CTL_MIN_BA);
+			if (ctl->density < 7)
+				ctl->density++;
+		} else if (ctl->bad_pct < MT_AMPDU_CTL_GOOD_PCT) {
+			ctl->ba_size = min_t(u32, ctl->ba_size * 2,
+					     ctl->ba_cap);
+			if (zero_len_del && ctl->density > ctl->density_min)
+				ctl->density--;
+		}
+		ctl->ba_size = min(ctl->ba_size, ctl->ba_cap);
+
+		trace_mt_ampdu_ctl(dev, wcid->idx, ctl->bad_pct, ctl->ba_size,
+				   ctl->density);
+		mt7601u_mac_ampdu_apply(msta);
+		spin_unlock_irqrestore(&dev->lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+static struct mt76_tx_status mt7601u_mac_decode_tx_status(u32 val)
 {
 	struct mt76_tx_status stat = {};
-	u32 val;
 
-	val = mt7601u_rr(dev, MT_TX_STAT_FIFO);
 	stat.valid = !!(val & MT_TX_STAT_FIFO_VALID);
 	stat.success = !!(val & MT_TX_STAT_FIFO_SUCCESS);
 	stat.aggr = !!(val & MT_TX_STAT_FIFO_AGGR);
@@ -167,13 +303,52 @@ struct mt76_tx_status mt7601u_mac_fetch_tx_status(struct mt7601u_dev *dev)
 	return stat;
 }
 
-void mt76_send_tx_status(struct mt7601u_dev *dev, struct mt76_tx_status *stat)
+/* Note: every read of MT_TX_STAT_FIFO pops one entry, so the FIFO can't be
+ *	 fetched with a single multi-read (that would read consecutive
+ *	 registers).  Drain it into @stat first and let the caller report
+ *	 everything afterwards so that we don't hold off FIFO reads while
+ *	 mac80211 is running rate control.
+ */
+int mt7601u_mac_fetch_tx_status(struct mt7601u_dev *dev,
+				struct mt76_tx_status *stat, int n)
+{
+	u32 raw[MT_TX_STAT_BATCH];
+	int i, cnt;
+
+	n = min(n, MT_TX_STAT_BATCH);
+
+	for (cnt = 0; cnt < n; cnt++) {
+		if (test_bit(MT7601U_STATE_REMOVED, &dev->state))
+			break;
+
+		raw[cnt] = mt7601u_rr(dev, MT_TX_STAT_FIFO);
+		if (!(raw[cnt] & MT_TX_STAT_FIFO_VALID))
+			break;
+	}
+
+	for (i = 0; i < cnt; i++)
+		stat[i] = mt7601u_mac_decode_tx_status(raw[i]);
+
+	return cnt;
+}
+
+void mt76_send_tx_status(struct mt7601u_dev *dev, struct mt76_tx_status *stat,
+			 struct sk_buff *skb)
 {
 	struct ieee80211_tx_info info = {};
 	struct ieee80211_sta *sta = NULL;
 	struct mt76_wcid *wcid = NULL;
 	void *msta;
 
+	if (skb) {
+		struct ieee80211_tx_info *skb_info = IEEE80211_SKB_CB(skb);
+
+		ieee80211_tx_info_clear_status(skb_info);
+		mt76_mac_fill_tx_status(dev, skb_info, stat);
+		ieee80211_tx_status(dev->hw, skb);
+		return;
+	}
+
 	rcu_read_lock();
 	if (stat->wcid < ARRAY_SIZE(dev->wcid))
 		wcid = rcu_dereference(dev->wcid[stat->wcid]);
@@ -182,6 +357,7 @@ void mt76_send_tx_status(struct mt7601u_dev *dev, struct mt76_tx_status *stat)
 		msta = container_of(wcid, struct mt76_sta, wcid);
 		sta = container_of(msta, struct ieee80211_sta,
 				   drv_priv);
+		mt7601u_mac_ampdu_feedback(msta, stat);
 	}
 
 	mt76_mac_fill_tx_status(dev, &info, stat);
@@ -244,8 +420,7 @@ void mt7601u_mac_set_protection(struct mt7601u_dev *dev, bool legacy_prot,
 		if (ht_rts[i])
 			prot[i + 2] |= MT_PROT_CTRL_RTS_CTS;
 
-	for (i = 0; i < 6; i++)
-		mt7601u_wr(dev, MT_CCK_PROT_CFG + i * 4, prot[i]);
+	mt7601u_burst_write_regs(dev, MT_CCK_PROT_CFG, prot, ARRAY_SIZE(prot));
 }
 
 void mt7601u_mac_set_short_preamble(struct mt7601u_dev *dev, bool short_preamb)
@@ -271,9 +446,10 @@ void mt7601u_mac_config_tsf(struct mt7601u_dev *dev, bool enable, int interval)
 
 	val &= ~MT_BEACON_TIME_CFG_INTVAL;
 	val |= MT76_SET(MT_BEACON_TIME_CFG_INTVAL, interval << 4) |
+		MT76_SET(MT_BEACON_TIME_CFG_SYNC_MODE, 1) |
 		MT_BEACON_TIME_CFG_TIMER_EN |
-		MT_BEACON_TIME_CFG_SYNC_MODE |
 		MT_BEACON_TIME_CFG_TBTT_EN;
+	mt7601u_wr(dev, MT_BEACON_TIME_CFG, val);
 }
 
 static void mt7601u_check_mac_err(struct mt7601u_dev *dev)
@@ -294,17 +470,22 @@ void mt7601u_mac_work(struct work_struct *work)
 {
 	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
 					       mac_work.work);
+	/* RX_STA_CNT0..TX_STA_CNT2, TX_AGG_STAT..MPDU_DENSITY_CNT and
+	 * TX_AGG_CNT_BASE1 block, read as three spans.
+	 */
+	u32 cnt[6 + 10 + 8];
 	struct {
-		u32 addr_base;
+		const u32 *vals;
 		u32 span;
 		u64 *stat_base;
+		bool aggr_n;
 	} spans[] = {
-		{ MT_RX_STA_CNT0,	3,	dev->stats.rx_stat },
-		{ MT_TX_STA_CNT0,	3,	dev->stats.tx_stat },
-		{ MT_TX_AGG_STAT,	1,	dev->stats.aggr_stat },
-		{ MT_MPDU_DENSITY_CNT,	1,	dev->stats.zero_len_del },
-		{ MT_TX_AGG_CNT_BASE0,	8,	&dev->stats.aggr_n[0] },
-		{ MT_TX_AGG_CNT_BASE1,	8,	&dev->stats.aggr_n[16] },
+		{ &cnt[0],	3,	dev->stats.rx_stat,		false },
+		{ &cnt[3],	3,	dev->stats.tx_stat,		false },
+		{ &cnt[6],	1,	dev->stats.aggr_stat,		false },
+		{ &cnt[15],	1,	dev->stats.zero_len_del,	false },
+		{ &cnt[7],	8,	&dev->stats.aggr_n[0],		true },
+		{ &cnt[16],	8,	&dev->stats.aggr_n[16],		true },
 	};
 	u32 sum, n;
 	int i, j, k;
@@ -312,22 +493,27 @@ void mt7601u_mac_work(struct work_struct *work)
 	/* Note: using MCU_RANDOM_READ is actually slower then reading all the
 	 *	 registers by hand.  MCU takes ca. 20ms to complete read of 24
 	 *	 registers while reading them one by one will takes roughly
-	 *	 24*200us =~ 5ms.
+	 *	 24*200us =~ 5ms.  Counters are read in contiguous spans instead,
+	 *	 one control transfer per span.  TX_STAT_FIFO sits right between
+	 *	 TX_STA_CNT2 and TX_AGG_STAT and must not be read here since
+	 *	 reading it pops an entry.
 	 */
+	mt7601u_rr_span(dev, MT_RX_STA_CNT0, &cnt[0], 6);
+	mt7601u_rr_span(dev, MT_TX_AGG_STAT, &cnt[6], 10);
+	mt7601u_rr_span(dev, MT_TX_AGG_CNT_BASE1, &cnt[16], 8);
 
 	k = 0;
 	n = 0;
 	sum = 0;
 	for (i = 0; i < ARRAY_SIZE(spans); i++)
 		for (j = 0; j < spans[i].span; j++) {
-			u32 val = mt7601u_rr(dev, spans[i].addr_base + j * 4);
+			u32 val = spans[i].vals[j];
 
 			spans[i].stat_base[j * 2] += val & 0xffff;
 			spans[i].stat_base[j * 2 + 1] += val >> 16;
 
 			/* Calculate average AMPDU length */
-			if (spans[i].addr_base != MT_TX_AGG_CNT_BASE0 &&
-			    spans[i].addr_base != MT_TX_AGG_CNT_BASE1)
+			if (!spans[i].aggr_n)
 				continue;
 
 			n += (val >> 16) + (val & 0xffff);
@@ -338,9 +524,13 @@ void mt7601u_mac_work(struct work_struct *work)
 
 	atomic_set(&dev->avg_ampdu_len, n ? DIV_ROUND_CLOSEST(sum, n) : 1);
 
+	mt7601u_mac_ampdu_ctl_step(dev, cnt[5] >> 16, cnt[15] & 0xffff);
+
 	mt7601u_check_mac_err(dev);
 
-	ieee80211_queue_delayed_work(dev->hw, &dev->mac_work, 10 * HZ);
+	ieee80211_queue_delayed_work(dev->hw, &dev->mac_work,
+			msecs_to_jiffies(max_t(u32, READ_ONCE(dev->mac_work_ms),
+					       MT_MAC_WORK_MIN_MS)));
 }
 
 void
@@ -360,12 +550,20 @@ mt7601u_mac_wcid_setup(struct mt7601u_dev *dev, u8 idx, u8 vif_idx, u8 *mac)
 	mt7601u_addr_wr(dev, MT_WCID_ADDR(idx), zmac);
 }
 
+static struct ieee80211_sta *mt7601u_wcid_to_sta(struct mt76_wcid *wcid)
+{
+	void *msta = container_of(wcid, struct mt76_sta, wcid);
+
+	return container_of(msta, struct ieee80211_sta, drv_priv);
+}
+
 void mt7601u_mac_set_ampdu_factor(struct mt7601u_dev *dev)
 {
 	struct ieee80211_sta *sta;
 	struct mt76_wcid *wcid;
-	void *msta;
-	u8 min_factor = 3;
+	struct mt76_sta *msta;
+	unsigned long flags;
+	u8 max_factor = 0;
 	int i;
 
 	rcu_read_lock();
@@ -374,15 +572,59 @@ void mt7601u_mac_set_ampdu_factor(struct mt7601u_dev *dev)
 		if (!wcid)
 			continue;
 
-		msta = container_of(wcid, struct mt76_sta, wcid);
-		sta = container_of(msta, struct ieee80211_sta, drv_priv);
-
-		min_factor = min(min_factor, sta->ht_cap.ampdu_factor);
+		sta = mt7601u_wcid_to_sta(wcid);
+		max_factor = max(max_factor, sta->ht_cap.ampdu_factor);
 	}
 	rcu_read_unlock();
 
+	dev->ampdu_factor = max_factor;
 	mt7601u_wr(dev, MT_MAX_LEN_CFG, 0xa0fff |
-		   MT76_SET(MT_MAX_LEN_CFG_AMPDU, min_factor));
+		   MT76_SET(MT_MAX_LEN_CFG_AMPDU, max_factor));
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(dev->wcid); i++) {
+		wcid = rcu_dereference(dev->wcid[i]);
+		if (!wcid)
+			continue;
+
+		msta = container_of(wcid, struct mt76_sta, wcid);
+		sta = mt7601u_wcid_to_sta(wcid);
+
+		spin_lock_irqsave(&dev->lock, flags);
+		msta->ampdu.ba_cap =
+			mt7601u_mac_ampdu_cap(sta->ht_cap.ampdu_factor,
+					      max_factor);
+		msta->ampdu.ba_size = min(msta->ampdu.ba_size,
+					  msta->ampdu.ba_cap);
+		mt7601u_mac_ampdu_apply(msta);
+		spin_unlock_irqrestore(&dev->lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+/* Note: in STA mode stations are added before association when their HT
+ *	 capabilities are not known yet, restart the controllers of all
+ *	 stations from what they have now.
+ */
+void mt7601u_mac_ampdu_refresh(struct mt7601u_dev *dev)
+{
+	struct mt76_wcid *wcid;
+	struct mt76_sta *msta;
+	int i;
+
+	mt7601u_mac_set_ampdu_factor(dev);
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(dev->wcid); i++) {
+		wcid = rcu_dereference(dev->wcid[i]);
+		if (!wcid)
+			continue;
+
+		msta = container_of(wcid, struct mt76_sta, wcid);
+		mt7601u_mac_ampdu_ctl_init(dev, msta,
+					   mt7601u_wcid_to_sta(wcid));
+	}
+	rcu_read_unlock();
 }
 
 static void
@@ -431,24 +673,48 @@ mt76_mac_process_rate(struct ieee80211_rx_status *status, u16 rate)
 		status->flag |= RX_FLAG_40MHZ;
 }
 
+/* Note: RX path (the RX tasklet) is the only one updating the averages,
+ *	 writers from other contexts only reset them, so plain read-modify-
+ *	 write of the atomics is sufficient.
+ */
+static void mt7601u_rx_monitor_rssi(struct mt7601u_dev *dev, int rssi)
+{
+	int avg = atomic_read(&dev->avg_rssi);
+
+	atomic_set(&dev->avg_rssi, (avg * 15) / 16 + (rssi << 8));
+}
+
 static void
 mt7601u_rx_monitor_beacon(struct mt7601u_dev *dev, struct mt7601u_rxwi *rxwi,
 			  u16 rate, int rssi)
 {
-	dev->bcn_freq_off = rxwi->freq_off;
-	dev->bcn_phy_mode = MT76_GET(MT_RXWI_RATE_PHY, rate);
-	dev->avg_rssi = (dev->avg_rssi * 15) / 16 + (rssi << 8);
+	atomic_set(&dev->bcn_mon,
+		   MT76_SET(MT_BCN_MON_FREQ_OFF, (u8)rxwi->freq_off) |
+		   MT76_SET(MT_BCN_MON_PHY_MODE,
+			    MT76_GET(MT_RXWI_RATE_PHY, rate)));
+	mt7601u_rx_monitor_rssi(dev, rssi);
 }
 
-static int
-mt7601u_rx_is_our_beacon(struct mt7601u_dev *dev, struct sk_buff *skb)
+static bool
+mt7601u_rx_is_our_beacon(struct mt7601u_dev *dev, u8 *data)
 {
-	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)skb->data;
-	return ieee80211_is_beacon(hdr->frame_control) &&
-		ether_addr_equal(hdr->addr2, dev->ap_bssid);
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)data;
+	struct mt7601u_bssid *bssid;
+	bool ret;
+
+	if (!ieee80211_is_beacon(hdr->frame_control))
+		return false;
+
+	rcu_read_lock();
+	bssid = rcu_dereference(dev->ap_bssid);
+	ret = bssid && ether_addr_equal(hdr->addr2, bssid->addr);
+	rcu_read_unlock();
+
+	return ret;
 }
 
-int mt76_mac_process_rx(struct mt7601u_dev *dev, struct sk_buff *skb, void *rxi)
+u32 mt76_mac_process_rx(struct mt7601u_dev *dev, struct sk_buff *skb,
+			u8 *data, u32 seg_len, void *rxi)
 {
 	struct ieee80211_rx_status *status = IEEE80211_SKB_RXCB(skb);
 	struct mt7601u_rxwi *rxwi = rxi;
@@ -462,7 +728,8 @@ int mt76_mac_process_rx(struct mt7601u_dev *dev, struct sk_buff *skb, void *rxi)
 	}
 
 	len = MT76_GET(MT_RXWI_CTL_MPDU_LEN, ctl);
-	skb_trim(skb, len);
+	if (len < 10)
+		return 0;
 
 	status->chains = BIT(0);
 	rssi = mt7601u_phy_get_rssi(dev, rxwi, rate);
@@ -472,14 +739,21 @@ int mt76_mac_process_rx(struct mt7601u_dev *dev, struct sk_buff *skb, void *rxi)
 
 	mt76_mac_process_rate(status, rate);
 
-	spin_lock_bh(&dev->con_mon_lock);
-	if (mt7601u_rx_is_our_beacon(dev, skb))
+	/* Truncated frames are dropped by the caller, don't look inside */
+	if (len > seg_len)
+		return len;
+
+	if (mt7601u_rx_is_our_beacon(dev, data)) {
 		mt7601u_rx_monitor_beacon(dev, rxwi, rate, rssi);
-	else if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_U2M))
-		dev->avg_rssi = (dev->avg_rssi * 15) / 16 + (rssi << 8);
-	spin_unlock_bh(&dev->con_mon_lock);
+		mt7601u_ps_rx_beacon(dev, data, len);
+		return len;
+	}
 
-	return 0;
+	if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_U2M))
+		mt7601u_rx_monitor_rssi(dev, rssi);
+	mt7601u_ps_rx_frame(dev, data);
+
+	return len;
 }
 
 static enum mt76_cipher_type
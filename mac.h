@@ -160,10 +160,11 @@ struct mt76_txwi {
 #define MT_TXWI_CTL_CHAN_CHECK_PKT	BIT(4)
 #define MT_TXWI_CTL_PIFS_REV		BIT(6)
 
-int
-mt76_mac_process_rx(struct mt7601u_dev *dev, struct sk_buff *skb, void *rxwi);
+u32 mt76_mac_process_rx(struct mt7601u_dev *dev, struct sk_buff *skb,
+			u8 *data, u32 seg_len, void *rxi);
 int mt76_mac_wcid_set_key(struct mt7601u_dev *dev, u8 idx,
 			  struct ieee80211_key_conf *key);
+void mt76_mac_wcid_init(struct mt76_wcid *wcid, u8 idx);
 void mt76_mac_wcid_set_rate(struct mt7601u_dev *dev, struct mt76_wcid *wcid,
 			    const struct ieee80211_tx_rate *rate);
 
@@ -171,8 +172,9 @@ int mt76_mac_shared_key_setup(struct mt7601u_dev *dev, u8 vif_idx, u8 key_idx,
 			      struct ieee80211_key_conf *key);
 u16 mt76_mac_tx_rate_val(struct mt7601u_dev *dev,
 			 const struct ieee80211_tx_rate *rate, u8 *nss_val);
-struct mt76_tx_status
-mt7601u_mac_fetch_tx_status(struct mt7601u_dev *dev);
-void mt76_send_tx_status(struct mt7601u_dev *dev, struct mt76_tx_status *stat);
+int mt7601u_mac_fetch_tx_status(struct mt7601u_dev *dev,
+				struct mt76_tx_status *stat, int n);
+void mt76_send_tx_status(struct mt7601u_dev *dev, struct mt76_tx_status *stat,
+			 struct sk_buff *skb);
 
 #endif
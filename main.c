@@ -26,16 +26,27 @@ static int mt7601u_start(struct ieee80211_hw *hw)
 	struct mt7601u_dev *dev = hw->priv;
 	int ret;
 
+	wait_for_completion(&dev->init_done);
+
 	mutex_lock(&dev->mutex);
 
+	if (!test_bit(MT7601U_STATE_INITIALIZED, &dev->state)) {
+		ret = -EIO;
+		goto out;
+	}
+
 	ret = mt7601u_mac_start(dev);
 	if (ret)
 		goto out;
+	set_bit(MT7601U_STATE_STARTED, &dev->state);
 
 	ieee80211_queue_delayed_work(dev->hw, &dev->mac_work,
 				     MT_CALIBRATE_INTERVAL);
 	ieee80211_queue_delayed_work(dev->hw, &dev->cal_work,
 				     MT_CALIBRATE_INTERVAL);
+	if (dev->in_max_packet == 512)
+		ieee80211_queue_delayed_work(dev->hw, &dev->rx_aggr_work,
+					     MT_RX_AGGR_INTERVAL);
 out:
 	mutex_unlock(&dev->mutex);
 	return ret;
@@ -45,11 +56,16 @@ static void mt7601u_stop(struct ieee80211_hw *hw)
 {
 	struct mt7601u_dev *dev = hw->priv;
 
+	/* rx_aggr_work takes the mutex */
+	cancel_delayed_work_sync(&dev->rx_aggr_work);
+
 	mutex_lock(&dev->mutex);
 
+	mt7601u_ps_set(dev, false);
 	cancel_delayed_work_sync(&dev->cal_work);
 	cancel_delayed_work_sync(&dev->mac_work);
 	mt7601u_mac_stop(dev);
+	clear_bit(MT7601U_STATE_STARTED, &dev->state);
 
 	mutex_unlock(&dev->mutex);
 }
@@ -72,8 +88,9 @@ static int mt7601u_add_interface(struct ieee80211_hw *hw,
 	if (dev->wcid_mask[wcid / BITS_PER_LONG] & BIT(wcid % BITS_PER_LONG))
 		return -ENOSPC;
 	dev->wcid_mask[wcid / BITS_PER_LONG] |= BIT(wcid % BITS_PER_LONG);
-	mvif->group_wcid.idx = wcid;
-	mvif->group_wcid.hw_key_idx = -1;
+	mt76_mac_wcid_init(&mvif->group_wcid, wcid);
+
+	mt7601u_txq_init(dev, vif->txq);
 
 	return 0;
 }
@@ -85,6 +102,7 @@ static void mt7601u_remove_interface(struct ieee80211_hw *hw,
 	struct mt76_vif *mvif = (struct mt76_vif *) vif->drv_priv;
 	unsigned int wcid = mvif->group_wcid.idx;
 
+	mt7601u_txq_remove(dev, vif->txq);
 	dev->wcid_mask[wcid / BITS_PER_LONG] &= ~BIT(wcid % BITS_PER_LONG);
 }
 
@@ -96,11 +114,15 @@ static int mt7601u_config(struct ieee80211_hw *hw, u32 changed)
 	mutex_lock(&dev->mutex);
 
 	if (changed & IEEE80211_CONF_CHANGE_CHANNEL) {
+		mt7601u_ps_wake(dev);
 		ieee80211_stop_queues(hw);
 		ret = mt7601u_phy_set_channel(dev, &hw->conf.chandef);
 		ieee80211_wake_queues(hw);
 	}
 
+	if (changed & IEEE80211_CONF_CHANGE_PS)
+		mt7601u_ps_set(dev, hw->conf.flags & IEEE80211_CONF_PS);
+
 	mutex_unlock(&dev->mutex);
 
 	return ret;
@@ -148,8 +170,10 @@ mt7601u_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 
 	mutex_lock(&dev->mutex);
 
-	if (changed & BSS_CHANGED_ASSOC)
+	if (changed & BSS_CHANGED_ASSOC) {
 		mt7601u_phy_con_cal_onoff(dev, info);
+		WRITE_ONCE(dev->ps.aid, info->aid);
+	}
 
 	if (changed & BSS_CHANGED_BSSID) {
 		mt7601u_addr_wr(dev, MT_MAC_BSSID_DW0, info->bssid);
@@ -158,20 +182,28 @@ mt7601u_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		 *	 on leave nor is any more appropriate event generated.
 		 *	 rt2x00 doesn't seem to be bothered though.
 		 */
-		if (is_zero_ether_addr(info->bssid))
+		if (is_zero_ether_addr(info->bssid)) {
 			mt7601u_mac_config_tsf(dev, false, 0);
+			dev->ps.beacon_int = 0;
+		}
 	}
 
 	if (changed & BSS_CHANGED_BASIC_RATES) {
-		mt7601u_wr(dev, MT_LEGACY_BASIC_RATE, info->basic_rates);
-		mt7601u_wr(dev, MT_HT_FBK_CFG0, 0x65432100);
-		mt7601u_wr(dev, MT_HT_FBK_CFG1, 0xedcba980);
-		mt7601u_wr(dev, MT_LG_FBK_CFG0, 0xedcba988);
-		mt7601u_wr(dev, MT_LG_FBK_CFG1, 0x00002100);
+		struct mt7601u_reg_batch b;
+
+		mt7601u_batch_init(dev, &b);
+		mt7601u_batch_wr(&b, MT_LEGACY_BASIC_RATE, info->basic_rates);
+		mt7601u_batch_wr(&b, MT_HT_FBK_CFG0, 0x65432100);
+		mt7601u_batch_wr(&b, MT_HT_FBK_CFG1, 0xedcba980);
+		mt7601u_batch_wr(&b, MT_LG_FBK_CFG0, 0xedcba988);
+		mt7601u_batch_wr(&b, MT_LG_FBK_CFG1, 0x00002100);
+		mt7601u_batch_commit(&b);
 	}
 
-	if (changed & BSS_CHANGED_BEACON_INT)
+	if (changed & BSS_CHANGED_BEACON_INT) {
 		mt7601u_mac_config_tsf(dev, true, info->beacon_int);
+		dev->ps.beacon_int = info->beacon_int;
+	}
 
 	if (changed & BSS_CHANGED_HT || changed & BSS_CHANGED_ERP_CTS_PROT)
 		mt7601u_mac_set_protection(dev, info->use_cts_prot,
@@ -187,6 +219,9 @@ mt7601u_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 			       MT_BKOFF_SLOT_CFG_SLOTTIME, slottime);
 	}
 
+	if (changed & (BSS_CHANGED_ASSOC | BSS_CHANGED_HT))
+		mt7601u_mac_ampdu_refresh(dev);
+
 	if (changed & BSS_CHANGED_ASSOC)
 		mt7601u_phy_recalibrate_after_assoc(dev);
 
@@ -223,7 +258,10 @@ mt7601u_sta_add(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 	struct mt76_sta *msta = (struct mt76_sta *) sta->drv_priv;
 	struct mt76_vif *mvif = (struct mt76_vif *) vif->drv_priv;
 	int ret = 0;
-	int idx = 0;
+	int i, idx = 0;
+
+	for (i = 0; i < ARRAY_SIZE(sta->txq); i++)
+		mt7601u_txq_init(dev, sta->txq[i]);
 
 	mutex_lock(&dev->mutex);
 
@@ -233,8 +271,8 @@ mt7601u_sta_add(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		goto out;
 	}
 
-	msta->wcid.idx = idx;
-	msta->wcid.hw_key_idx = -1;
+	mt76_mac_wcid_init(&msta->wcid, idx);
+	mt7601u_mac_ampdu_ctl_init(dev, msta, sta);
 	mt7601u_mac_wcid_setup(dev, idx, mvif->idx, sta->addr);
 	mt76_clear(dev, MT_WCID_DROP(idx), MT_WCID_DROP_MASK(idx));
 	rcu_assign_pointer(dev->wcid[idx], &msta->wcid);
@@ -252,7 +290,10 @@ mt7601u_sta_remove(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 {
 	struct mt7601u_dev *dev = hw->priv;
 	struct mt76_sta *msta = (struct mt76_sta *) sta->drv_priv;
-	int idx = msta->wcid.idx;
+	int i, idx = msta->wcid.idx;
+
+	for (i = 0; i < ARRAY_SIZE(sta->txq); i++)
+		mt7601u_txq_remove(dev, sta->txq[i]);
 
 	mutex_lock(&dev->mutex);
 	rcu_assign_pointer(dev->wcid[idx], NULL);
@@ -396,6 +437,7 @@ out:
 
 const struct ieee80211_ops mt7601u_ops = {
 	.tx = mt7601u_tx,
+	.wake_tx_queue = mt7601u_wake_tx_queue,
 	.start = mt7601u_start,
 	.stop = mt7601u_stop,
 	.add_interface = mt7601u_add_interface,
@@ -410,6 +452,8 @@ const struct ieee80211_ops mt7601u_ops = {
 	.conf_tx = mt7601u_conf_tx,
 	.sw_scan_start = mt7601u_sw_scan,
 	.sw_scan_complete = mt7601u_sw_scan_complete,
+	.hw_scan = mt7601u_hw_scan,
+	.cancel_hw_scan = mt7601u_cancel_hw_scan,
 /*	.flush = mt7601u_flush,*/
 	.ampdu_action = mt76_ampdu_action,
 	.sta_rate_tbl_update = mt76_sta_rate_tbl_update,
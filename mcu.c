@@ -27,6 +27,7 @@
 
 #define MCU_FW_URB_MAX_PAYLOAD		0x3800
 #define MCU_FW_URB_SIZE			(MCU_FW_URB_MAX_PAYLOAD + 12)
+#define MCU_FW_BUFS			2
 #define MCU_RESP_URB_SIZE		1024
 
 static inline int firmware_running(struct mt7601u_dev *dev)
@@ -72,91 +73,264 @@ mt7601u_mcu_msg_alloc(struct mt7601u_dev *dev, const void *data, int len)
 	return skb;
 }
 
-static int mt7601u_mcu_wait_resp(struct mt7601u_dev *dev, u8 seq)
+/* Grab a free sequence number for @c.  Numbers are handed out round robin
+ * so that late response to a command which timed out is unlikely to be
+ * taken for a response to a new one.  Seq 0 means no response and is never
+ * handed out.
+ */
+static u8
+mt7601u_mcu_seq_get(struct mt7601u_dev *dev, struct mt7601u_mcu_cmd *c)
 {
-	struct urb *urb = dev->mcu.resp.urb;
-	u32 rxfce;
-	int urb_status, ret, i = 5;
+	struct mt7601u_mcu *mcu = &dev->mcu;
+	unsigned long flags;
+	u8 seq = 0;
+	int i;
 
-	while (i--) {
-		if (!wait_for_completion_timeout(&dev->mcu.resp_cmpl,
-						 msecs_to_jiffies(300))) {
-			dev_warn(dev->dev, "Warning: %s retrying\n", __func__);
+	spin_lock_irqsave(&mcu->lock, flags);
+	for (i = 0; i < MT_MCU_SEQ_MAX - 1; i++) {
+		mcu->msg_seq = mcu->msg_seq % (MT_MCU_SEQ_MAX - 1) + 1;
+		if (mcu->pending[mcu->msg_seq])
 			continue;
-		}
 
-		/* Make copies of important data before reusing the urb */
-		rxfce = get_unaligned_le32(dev->mcu.resp.buf);
-		urb_status = urb->status * mt7601u_urb_has_error(urb);
+		seq = mcu->msg_seq;
+		mcu->pending[seq] = c;
+		c->seq = seq;
+		break;
+	}
+	spin_unlock_irqrestore(&mcu->lock, flags);
 
-		ret = mt7601u_usb_submit_buf(dev, USB_DIR_IN, MT_EP_IN_CMD_RESP,
-					     &dev->mcu.resp, GFP_KERNEL,
-					     mt7601u_complete_urb,
-					     &dev->mcu.resp_cmpl);
-		if (ret)
-			return ret;
+	return seq;
+}
 
-		if (urb_status)
-			dev_err(dev->dev, "Error: MCU resp urb failed:%d\n",
-				urb_status);
+/* Drop @c from the pending table unless response handler already did.
+ * Returns true if @c was still pending.
+ */
+static bool
+mt7601u_mcu_seq_put(struct mt7601u_dev *dev, struct mt7601u_mcu_cmd *c, int ret)
+{
+	struct mt7601u_mcu *mcu = &dev->mcu;
+	unsigned long flags;
+	bool pending;
+
+	spin_lock_irqsave(&mcu->lock, flags);
+	pending = mcu->pending[c->seq] == c;
+	if (pending) {
+		mcu->pending[c->seq] = NULL;
+		c->ret = ret;
+	}
+	spin_unlock_irqrestore(&mcu->lock, flags);
+
+	wake_up(&mcu->seq_wait);
 
-		if (MT76_GET(MT_RXD_CMD_INFO_CMD_SEQ, rxfce) == seq &&
-		    MT76_GET(MT_RXD_CMD_INFO_EVT_TYPE, rxfce) == CMD_DONE)
-			return 0;
+	return pending;
+}
+
+/* Complete all commands waiting for response with @ret. */
+static void mt7601u_mcu_cmd_fail_all(struct mt7601u_dev *dev, int ret)
+{
+	struct mt7601u_mcu *mcu = &dev->mcu;
+	unsigned long flags;
+	int i;
 
-		dev_err(dev->dev, "Error: MCU resp evt:%hhx seq:%hhx-%hhx!\n",
-			MT76_GET(MT_RXD_CMD_INFO_EVT_TYPE, rxfce),
-			seq, MT76_GET(MT_RXD_CMD_INFO_CMD_SEQ, rxfce));
+	spin_lock_irqsave(&mcu->lock, flags);
+	for (i = 1; i < MT_MCU_SEQ_MAX; i++) {
+		struct mt7601u_mcu_cmd *c = mcu->pending[i];
+
+		if (!c)
+			continue;
+
+		mcu->pending[i] = NULL;
+		c->ret = ret;
+		complete(&c->cmpl);
 	}
+	spin_unlock_irqrestore(&mcu->lock, flags);
 
-	dev_err(dev->dev, "Error: %s timed out\n", __func__);
-	return -ETIMEDOUT;
+	wake_up(&mcu->seq_wait);
 }
 
-static int
-mt7601u_mcu_msg_send(struct mt7601u_dev *dev, struct sk_buff *skb,
-		     enum mcu_cmd cmd, bool wait_resp)
+static int mt7601u_mcu_resp_submit(struct mt7601u_dev *dev, gfp_t gfp);
+
+static void mt7601u_mcu_resp_complete(struct urb *urb)
+{
+	struct mt7601u_dev *dev = urb->context;
+	struct mt7601u_mcu *mcu = &dev->mcu;
+	struct mt7601u_mcu_cmd *c;
+	unsigned long flags;
+	u32 rxfce;
+	u8 seq, evt;
+	int ret;
+
+	if (urb->status && !mt7601u_urb_has_error(urb))
+		return;
+
+	if (urb->status) {
+		dev_err(dev->dev, "Error: MCU resp urb failed:%d\n",
+			urb->status);
+		goto resubmit;
+	}
+	if (urb->actual_length < sizeof(rxfce))
+		goto resubmit;
+
+	rxfce = get_unaligned_le32(mcu->resp.buf);
+	seq = MT76_GET(MT_RXD_CMD_INFO_CMD_SEQ, rxfce);
+	evt = MT76_GET(MT_RXD_CMD_INFO_EVT_TYPE, rxfce);
+
+	spin_lock_irqsave(&mcu->lock, flags);
+	c = seq ? mcu->pending[seq] : NULL;
+	if (c) {
+		mcu->pending[seq] = NULL;
+		c->ret = evt == CMD_DONE ? 0 : -EIO;
+		complete(&c->cmpl);
+	}
+	spin_unlock_irqrestore(&mcu->lock, flags);
+
+	if (!c || evt != CMD_DONE)
+		dev_err(dev->dev, "Error: MCU resp evt:%hhx seq:%hhx%s!\n",
+			evt, seq, c ? "" : " unexpected");
+	if (c)
+		wake_up(&mcu->seq_wait);
+resubmit:
+	if (test_bit(MT7601U_STATE_REMOVED, &dev->state))
+		return;
+
+	ret = mt7601u_mcu_resp_submit(dev, GFP_ATOMIC);
+	if (ret) {
+		/* Nobody would complete outstanding commands, they'd all
+		 * time out.  Fail them now, next command rearms the URB.
+		 */
+		dev_err(dev->dev, "Error: MCU resp urb resubmit failed:%d\n",
+			ret);
+		set_bit(MT7601U_STATE_MCU_RESP_STOPPED, &dev->state);
+		mt7601u_mcu_cmd_fail_all(dev, ret);
+	}
+}
+
+static int mt7601u_mcu_resp_submit(struct mt7601u_dev *dev, gfp_t gfp)
+{
+	return mt7601u_usb_submit_buf(dev, USB_DIR_IN, MT_EP_IN_CMD_RESP,
+				      &dev->mcu.resp, gfp,
+				      mt7601u_mcu_resp_complete, dev);
+}
+
+/**
+ * mt7601u_mcu_cmd_submit - send MCU command without waiting for response
+ * @dev:	pointer to adapter structure
+ * @skb:	command payload, always consumed
+ * @cmd:	command type
+ * @c:		tracking structure if caller wants the response, or NULL
+ *
+ * Commands with @c get a sequence number and are completed by the response
+ * URB handler, caller should collect the result with mt7601u_mcu_cmd_wait()
+ * if this function returned 0.  Up to %MT_MCU_SEQ_MAX - 1 commands can be
+ * in flight; when they are all taken, the call sleeps until one frees up.
+ * Commands without @c are fire and forget.
+ *
+ * Must be called from process context.
+ */
+int mt7601u_mcu_cmd_submit(struct mt7601u_dev *dev, struct sk_buff *skb,
+			   enum mcu_cmd cmd, struct mt7601u_mcu_cmd *c)
 {
 	struct usb_device *usb_dev = mt7601u_to_usb_dev(dev);
 	unsigned cmd_pipe = usb_sndbulkpipe(usb_dev,
 					    dev->out_eps[MT_EP_OUT_INBAND_CMD]);
-	int sent, ret;
+	ktime_t start = ktime_get();
+	int sent, ret = 0;
 	u8 seq = 0;
 
+	if (c) {
+		init_completion(&c->cmpl);
+		c->start = start;
+		c->ret = 0;
+		c->seq = 0;
+	}
+
 	if (test_bit(MT7601U_STATE_REMOVED, &dev->state))
-		return 0;
+		goto out;
 
-	mutex_lock(&dev->mcu.mutex);
+	if (c && test_and_clear_bit(MT7601U_STATE_MCU_RESP_STOPPED,
+				    &dev->state)) {
+		ret = mt7601u_mcu_resp_submit(dev, GFP_KERNEL);
+		if (ret) {
+			set_bit(MT7601U_STATE_MCU_RESP_STOPPED, &dev->state);
+			dev_err(dev->dev, "Error: MCU resp urb rearm failed:%d\n",
+				ret);
+			goto out;
+		}
+	}
 
-	if (wait_resp)
-		while (!seq)
-			seq = ++dev->mcu.msg_seq & 0xf;
+	if (c && !wait_event_timeout(dev->mcu.seq_wait,
+				     (seq = mt7601u_mcu_seq_get(dev, c)),
+				     msecs_to_jiffies(MT_MCU_RESP_TIMEOUT_MS))) {
+		dev_err(dev->dev, "Error: no free MCU sequence numbers\n");
+		ret = -EBUSY;
+		goto out;
+	}
 
 	mt7601u_dma_skb_wrap_cmd(skb, seq, cmd);
 
-	if (dev->mcu.resp_cmpl.done)
-		dev_err(dev->dev, "Error: MCU response pre-completed!\n");
-
-	trace_mt_mcu_msg_send_cs(dev, skb, wait_resp);
+	mutex_lock(&dev->mcu.mutex);
+	trace_mt_mcu_msg_send_cs(dev, skb, !!c);
 	trace_mt_submit_urb_sync(dev, cmd_pipe, skb->len);
 	ret = usb_bulk_msg(usb_dev, cmd_pipe, skb->data, skb->len, &sent, 500);
+	mutex_unlock(&dev->mcu.mutex);
 	if (ret) {
 		dev_err(dev->dev, "Error: send MCU cmd failed:%d\n", ret);
+		if (c)
+			mt7601u_mcu_seq_put(dev, c, ret);
 		goto out;
 	}
 	if (sent != skb->len)
 		dev_err(dev->dev, "Error: %s sent != skb->len\n", __func__);
 
-	if (wait_resp)
-		ret = mt7601u_mcu_wait_resp(dev, seq);
+	if (!c)
+		mt7601u_lat_account(dev, MT_LAT_MCU_CMD, start);
 out:
-	mutex_unlock(&dev->mcu.mutex);
-
 	consume_skb(skb);
 
 	return ret;
 }
 
+/**
+ * mt7601u_mcu_cmd_wait - wait for response to command
+ * @dev:	pointer to adapter structure
+ * @c:		command passed to successful mt7601u_mcu_cmd_submit()
+ *
+ * Returns 0 if MCU reported the command as done, -ETIMEDOUT if response
+ * didn't come in time and other negative error otherwise.
+ */
+int mt7601u_mcu_cmd_wait(struct mt7601u_dev *dev, struct mt7601u_mcu_cmd *c)
+{
+	if (!c->seq)
+		return c->ret;
+
+	if (!wait_for_completion_timeout(&c->cmpl,
+				msecs_to_jiffies(MT_MCU_RESP_TIMEOUT_MS)) &&
+	    mt7601u_mcu_seq_put(dev, c, -ETIMEDOUT))
+		dev_err(dev->dev, "Error: MCU resp seq:%hhx timed out\n",
+			c->seq);
+
+	mt7601u_lat_account(dev, MT_LAT_MCU_CMD, c->start);
+
+	return c->ret;
+}
+
+static int
+mt7601u_mcu_msg_send(struct mt7601u_dev *dev, struct sk_buff *skb,
+		     enum mcu_cmd cmd, bool wait_resp)
+{
+	struct mt7601u_prof_ctx prof;
+	struct mt7601u_mcu_cmd c;
+	int ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = mt7601u_mcu_cmd_submit(dev, skb, cmd, wait_resp ? &c : NULL);
+	if (!ret && wait_resp)
+		ret = mt7601u_mcu_cmd_wait(dev, &c);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_MCU, _RET_IP_);
+
+	return ret;
+}
+
 static int mt7601u_mcu_function_select(struct mt7601u_dev *dev,
 				       enum mcu_function func, u32 val)
 {
@@ -203,13 +377,20 @@ mt7601u_mcu_calibrate(struct mt7601u_dev *dev, enum mcu_calibrate cal, u32 val)
 		.id = cpu_to_le32(cal),
 		.value = cpu_to_le32(val),
 	};
+	int ret;
 
 	skb = mt7601u_mcu_msg_alloc(dev, &msg, sizeof(msg));
-	return mt7601u_mcu_msg_send(dev, skb, CMD_CALIBRATION_OP, true);
+	ret = mt7601u_mcu_msg_send(dev, skb, CMD_CALIBRATION_OP, true);
+
+	/* Calibrations leave their results in BBP/RF registers */
+	mt7601u_phy_shadow_reset(dev);
+
+	return ret;
 }
 
-int mt7601u_write_reg_pairs(struct mt7601u_dev *dev, u32 base,
-			    const struct mt76_reg_pair *data, int n)
+static int
+__mt7601u_write_reg_pairs(struct mt7601u_dev *dev, u32 base,
+			  const struct mt76_reg_pair *data, int n, bool wait)
 {
 	const int max_vals_per_cmd = INBAND_PACKET_MAX_LEN/8;
 	struct sk_buff *skb;
@@ -230,15 +411,66 @@ int mt7601u_write_reg_pairs(struct mt7601u_dev *dev, u32 base,
 		skb_put_le32(skb, data[i].value);
 	}
 
-	ret = mt7601u_mcu_msg_send(dev, skb, CMD_RANDOM_WRITE, cnt == n);
+	ret = mt7601u_mcu_msg_send(dev, skb, CMD_RANDOM_WRITE,
+				   wait && cnt == n);
 	if (ret)
 		return ret;
 
-	return mt7601u_write_reg_pairs(dev, base, data + cnt, n - cnt);
+	for (i = 0; i < cnt; i++)
+		if ((base + data[i].reg) & (MT_MCU_MEMMAP_BBP | MT_MCU_MEMMAP_RF))
+			mt7601u_phy_shadow_update(dev, base + data[i].reg,
+						  data[i].value);
+
+	return __mt7601u_write_reg_pairs(dev, base, data + cnt, n - cnt, wait);
+}
+
+static int
+__mt7601u_burst_write_regs(struct mt7601u_dev *dev, u32 addr,
+			   const u32 *data, int n, bool wait)
+{
+	const int max_regs_per_cmd = INBAND_PACKET_MAX_LEN/4 - 1;
+	struct sk_buff *skb;
+	int cnt, i, ret;
+
+	if (!n)
+		return 0;
+
+	cnt = min(max_regs_per_cmd, n);
+
+	skb = alloc_skb(cnt * 4 + MT_DMA_HDR_LEN + 4, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	skb_reserve(skb, MT_DMA_HDR_LEN);
+
+	skb_put_le32(skb, addr);
+	for (i = 0; i < cnt; i++)
+		skb_put_le32(skb, data[i]);
+
+	ret = mt7601u_mcu_msg_send(dev, skb, CMD_BURST_WRITE, wait && cnt == n);
+	if (ret)
+		return ret;
+
+	return __mt7601u_burst_write_regs(dev, addr + cnt * 4,
+					  data + cnt, n - cnt, wait);
 }
 
 int mt7601u_burst_write_regs(struct mt7601u_dev *dev, u32 offset,
 			     const u32 *data, int n)
+{
+	struct mt7601u_prof_ctx prof;
+	int ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt7601u_burst_write_regs(dev, MT_MCU_MEMMAP_WLAN + offset,
+					 data, n, true);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_MCU, _RET_IP_);
+
+	return ret;
+}
+
+static int
+__mt7601u_burst_write_pairs(struct mt7601u_dev *dev, u32 base,
+			    const struct mt76_reg_pair *data, int n, bool wait)
 {
 	const int max_regs_per_cmd = INBAND_PACKET_MAX_LEN/4 - 1;
 	struct sk_buff *skb;
@@ -254,16 +486,244 @@ int mt7601u_burst_write_regs(struct mt7601u_dev *dev, u32 offset,
 		return -ENOMEM;
 	skb_reserve(skb, MT_DMA_HDR_LEN);
 
-	skb_put_le32(skb, MT_MCU_MEMMAP_WLAN + offset);
+	skb_put_le32(skb, base + data[0].reg);
 	for (i = 0; i < cnt; i++)
-		skb_put_le32(skb, data[i]);
+		skb_put_le32(skb, data[i].value);
 
-	ret = mt7601u_mcu_msg_send(dev, skb, CMD_BURST_WRITE, cnt == n);
+	ret = mt7601u_mcu_msg_send(dev, skb, CMD_BURST_WRITE, wait && cnt == n);
 	if (ret)
 		return ret;
 
-	return mt7601u_burst_write_regs(dev, offset + cnt * 4,
-					data + cnt, n - cnt);
+	return __mt7601u_burst_write_pairs(dev, base, data + cnt, n - cnt,
+					   wait);
+}
+
+/* Length of the run of consecutive MAC registers at the start of @data */
+static int
+mt7601u_reg_run_len(u32 base, const struct mt76_reg_pair *data, int n)
+{
+	int j;
+
+	if ((base + data[0].reg) & (MT_MCU_MEMMAP_BBP | MT_MCU_MEMMAP_RF))
+		return 1;
+
+	for (j = 1; j < n; j++)
+		if (data[j].reg != data[j - 1].reg + 4)
+			break;
+
+	return j;
+}
+
+/* Note: write order is preserved, runs of at least MT_REG_BATCH_MIN_BURST
+ *	 consecutive MAC registers are sent as burst writes (4 bytes per
+ *	 register instead of 8), everything in between is packed into random
+ *	 write commands.  Commands are streamed back to back and, if @wait
+ *	 is set, only the last one waits for the response.
+ */
+static int
+__mt7601u_write_reg_stream(struct mt7601u_dev *dev, u32 base,
+			   const struct mt76_reg_pair *data, int n, bool wait)
+{
+	int i, run, first = 0, ret;
+
+	for (i = 0; i < n; i += run) {
+		run = mt7601u_reg_run_len(base, data + i, n - i);
+		if (run < MT_REG_BATCH_MIN_BURST)
+			continue;
+
+		ret = __mt7601u_write_reg_pairs(dev, base, data + first,
+						i - first, false);
+		if (ret)
+			return ret;
+
+		ret = __mt7601u_burst_write_pairs(dev, base, data + i, run,
+						  wait && i + run == n);
+		if (ret)
+			return ret;
+
+		first = i + run;
+	}
+
+	return __mt7601u_write_reg_pairs(dev, base, data + first, n - first,
+					 wait);
+}
+
+int mt7601u_write_reg_pairs(struct mt7601u_dev *dev, u32 base,
+			    const struct mt76_reg_pair *data, int n)
+{
+	struct mt7601u_prof_ctx prof;
+	int ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt7601u_write_reg_stream(dev, base, data, n, true);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_MCU, _RET_IP_);
+
+	return ret;
+}
+
+/**
+ * mt7601u_write_reg_prog - write a sequence of register tables
+ * @dev:	pointer to adapter structure
+ * @prog:	tables to write, in order
+ * @n:		number of entries in @prog
+ *
+ * All tables are streamed to the MCU as one sequence of commands and only
+ * the last command waits for the response.
+ */
+int mt7601u_write_reg_prog(struct mt7601u_dev *dev,
+			   const struct mt7601u_reg_prog *prog, int n)
+{
+	struct mt7601u_prof_ctx prof;
+	int i, ret = 0;
+
+	mt7601u_prof_enter(dev, &prof);
+	for (i = 0; i < n; i++) {
+		ret = __mt7601u_write_reg_stream(dev, prog[i].base,
+						 prog[i].regs, prog[i].n,
+						 i == n - 1);
+		if (ret)
+			break;
+	}
+	mt7601u_prof_exit(dev, &prof, MT_PROF_MCU, _RET_IP_);
+
+	return ret;
+}
+
+/**
+ * mt7601u_batch_init - start a new register write batch
+ * @dev:	pointer to adapter structure
+ * @b:		batch to initialize (usually on the stack)
+ *
+ * Register batches queue writes to MAC (WLAN) and BBP registers and send
+ * them to the MCU in as few in-band commands as possible.  Consecutive MAC
+ * registers are turned into burst writes, everything else is packed into
+ * random write commands.  Only the last command waits for the response,
+ * so the whole batch costs one round trip.
+ *
+ * Batches can only be committed once MCU command path is up.  Before that
+ * (and after the MCU is stopped) writes fall back to plain register writes.
+ */
+void mt7601u_batch_init(struct mt7601u_dev *dev, struct mt7601u_reg_batch *b)
+{
+	b->dev = dev;
+	b->n = 0;
+	b->ret = 0;
+}
+
+static void
+mt7601u_batch_add(struct mt7601u_reg_batch *b, u32 addr, u32 val)
+{
+	if (b->n == ARRAY_SIZE(b->regs))
+		mt7601u_batch_commit(b);
+
+	b->regs[b->n].reg = addr;
+	b->regs[b->n].value = val;
+	b->n++;
+}
+
+void mt7601u_batch_wr(struct mt7601u_reg_batch *b, u32 offset, u32 val)
+{
+	WARN_ONCE(offset > USHRT_MAX, "batch write high off:%08x", offset);
+
+	mt7601u_batch_add(b, MT_MCU_MEMMAP_WLAN + offset, val);
+}
+
+void mt7601u_batch_bbp_wr(struct mt7601u_reg_batch *b, u8 offset, u8 val)
+{
+	mt7601u_batch_add(b, MT_MCU_MEMMAP_BBP + offset, val);
+}
+
+/* Note: only RF bank 0 is reachable through MCU register map. */
+void mt7601u_batch_rf_wr(struct mt7601u_reg_batch *b, u8 offset, u8 val)
+{
+	mt7601u_batch_add(b, MT_MCU_MEMMAP_RF + offset, val);
+}
+
+/**
+ * mt7601u_batch_rr - read MAC register in the context of a batch
+ * @b:		register batch
+ * @offset:	register offset
+ *
+ * If there is a write to @offset queued the queued value is returned,
+ * otherwise the register is read from the device.  Note that reads are
+ * not ordered with queued writes to other registers!
+ */
+u32 mt7601u_batch_rr(struct mt7601u_reg_batch *b, u32 offset)
+{
+	u32 addr = MT_MCU_MEMMAP_WLAN + offset;
+	int i;
+
+	for (i = b->n - 1; i >= 0; i--)
+		if (b->regs[i].reg == addr)
+			return b->regs[i].value;
+
+	return mt7601u_rr(b->dev, offset);
+}
+
+u32 mt7601u_batch_rmw(struct mt7601u_reg_batch *b, u32 offset,
+		      u32 mask, u32 val)
+{
+	val |= mt7601u_batch_rr(b, offset) & ~mask;
+	mt7601u_batch_wr(b, offset, val);
+	return val;
+}
+
+static int mt7601u_batch_commit_direct(struct mt7601u_reg_batch *b)
+{
+	int i;
+
+	for (i = 0; i < b->n; i++) {
+		u32 addr = b->regs[i].reg;
+
+		if (WARN_ONCE(addr & (MT_MCU_MEMMAP_BBP | MT_MCU_MEMMAP_RF),
+			      "indirect reg write %08x without MCU", addr))
+			continue;
+
+		mt7601u_wr(b->dev, addr - MT_MCU_MEMMAP_WLAN, b->regs[i].value);
+	}
+
+	return 0;
+}
+
+/**
+ * mt7601u_batch_commit - send all queued writes to the device
+ * @b:		register batch
+ *
+ * Return: first error encountered while committing this batch (including
+ * implicit commits caused by the batch filling up).
+ */
+int mt7601u_batch_commit(struct mt7601u_reg_batch *b)
+{
+	struct mt7601u_dev *dev = b->dev;
+	struct mt7601u_prof_ctx prof;
+	int i, ret = 0;
+
+	if (!b->n)
+		return b->ret;
+
+	mt7601u_prof_enter(dev, &prof);
+
+	if (!test_bit(MT7601U_STATE_MCU_RUNNING, &dev->state)) {
+		ret = mt7601u_batch_commit_direct(b);
+		goto out;
+	}
+
+	for (i = 0; i < b->n; i++)
+		if (!(b->regs[i].reg & (MT_MCU_MEMMAP_BBP | MT_MCU_MEMMAP_RF)))
+			trace_reg_write(dev, b->regs[i].reg -
+					MT_MCU_MEMMAP_WLAN, b->regs[i].value);
+
+	ret = __mt7601u_write_reg_stream(dev, 0, b->regs, b->n, true);
+out:
+	mt7601u_prof_exit(dev, &prof, MT_PROF_MCU, _RET_IP_);
+	if (ret)
+		dev_err(dev->dev, "Error: register batch commit failed:%d\n",
+			ret);
+	if (!b->ret)
+		b->ret = ret;
+	b->n = 0;
+
+	return b->ret;
 }
 
 struct mt76_fw_header {
@@ -281,103 +741,255 @@ struct mt76_fw {
 	u8 ilm[];
 };
 
-static int __mt7601u_dma_fw(struct mt7601u_dev *dev,
-			    const struct mt7601u_dma_buf *dma_buf,
-			    const void *data, u32 len, u32 dst_addr)
+/**
+ * struct mt7601u_fw_seg - piece of firmware image to be DMAed to the MCU
+ * @data:	source data.
+ * @len:	length of @data.
+ * @dst:	destination address in MCU memory.
+ */
+struct mt7601u_fw_seg {
+	const void *data;
+	u32 len;
+	u32 dst;
+};
+
+/**
+ * struct mt7601u_fw_dma - state of firmware upload
+ * @buf:	coherent transfer buffers, filled in turn so that the next
+ *		chunk can be prepared while the previous one is in flight.
+ * @cmpl:	completion of the URB in flight.
+ * @fce_addr:	value last written to MT_FCE_DMA_ADDR.
+ * @fce_len:	value last written to MT_FCE_DMA_LEN.
+ * @fce_valid:	@fce_addr and @fce_len reflect the register state.
+ * @desc_idx:	FCE CPU descriptor index.
+ *
+ * FCE can only handle one descriptor at a time (tx_fs_max_cnt is set to 1
+ * in mt7601u_load_firmware()) so URBs can't be queued ahead, what we can
+ * overlap is preparing the data and the transfer itself.
+ */
+struct mt7601u_fw_dma {
+	struct mt7601u_dma_buf buf[MCU_FW_BUFS];
+	struct completion cmpl;
+
+	u32 fce_addr;
+	u32 fce_len;
+	bool fce_valid;
+	u32 desc_idx;
+};
+
+static bool
+mt7601u_fw_next_chunk(const struct mt7601u_fw_seg *segs, int n_segs,
+		      int *seg, u32 *off, struct mt7601u_fw_seg *chunk)
+{
+	while (*seg < n_segs && *off >= segs[*seg].len) {
+		(*seg)++;
+		*off = 0;
+	}
+	if (*seg >= n_segs)
+		return false;
+
+	chunk->data = segs[*seg].data + *off;
+	chunk->len = min_t(u32, MCU_FW_URB_MAX_PAYLOAD, segs[*seg].len - *off);
+	chunk->dst = segs[*seg].dst + *off;
+	*off += chunk->len;
+
+	return true;
+}
+
+static void mt7601u_fw_fill_buf(struct mt7601u_dma_buf *buf,
+				const struct mt7601u_fw_seg *chunk)
 {
-	DECLARE_COMPLETION_ONSTACK(cmpl);
-	struct mt7601u_dma_buf buf = *dma_buf; /* we need to fake length */
 	__le32 reg;
-	u32 val;
-	int ret;
 
 	reg = cpu_to_le32(MT76_SET(MT_TXD_INFO_TYPE, DMA_PACKET) |
 			  MT76_SET(MT_TXD_INFO_D_PORT, CPU_TX_PORT) |
-			  MT76_SET(MT_TXD_INFO_LEN, len));
-	memcpy(buf.buf, &reg, sizeof(reg));
-	memcpy(buf.buf + sizeof(reg), data, len);
-	memset(buf.buf + sizeof(reg) + len, 0, 8);
+			  MT76_SET(MT_TXD_INFO_LEN, chunk->len));
+	memcpy(buf->buf, &reg, sizeof(reg));
+	memcpy(buf->buf + sizeof(reg), chunk->data, chunk->len);
+	memset(buf->buf + sizeof(reg) + chunk->len, 0, 8);
+}
+
+/* Note: FCE registers are written 16 bits at a time, the length has its low
+ *	 half always cleared and addresses of consecutive chunks usually share
+ *	 the high half, so only write the halves which have changed.
+ */
+static int mt7601u_fw_fce_wr(struct mt7601u_dev *dev, u16 offset, u32 val,
+			     u32 *cache, bool valid)
+{
+	int ret;
+
+	if (!valid || (val & 0xffff) != (*cache & 0xffff)) {
+		ret = mt7601u_vendor_request(dev, MT_VEND_WRITE_FCE,
+					     USB_DIR_OUT, val & 0xffff, offset,
+					     NULL, 0);
+		if (ret)
+			return ret;
+	}
+	if (!valid || (val >> 16) != (*cache >> 16)) {
+		ret = mt7601u_vendor_request(dev, MT_VEND_WRITE_FCE,
+					     USB_DIR_OUT, val >> 16, offset + 2,
+					     NULL, 0);
+		if (ret)
+			return ret;
+	}
+
+	*cache = val;
+	return 0;
+}
+
+static int mt7601u_fw_setup_chunk(struct mt7601u_dev *dev,
+				  struct mt7601u_fw_dma *fw_dma,
+				  const struct mt7601u_fw_seg *chunk)
+{
+	bool valid = fw_dma->fce_valid;
+	int ret;
+
+	fw_dma->fce_valid = false;
 
-	ret = mt7601u_vendor_single_wr(dev, MT_VEND_WRITE_FCE,
-				       MT_FCE_DMA_ADDR, dst_addr);
+	ret = mt7601u_fw_fce_wr(dev, MT_FCE_DMA_ADDR, chunk->dst,
+				&fw_dma->fce_addr, valid);
 	if (ret)
 		return ret;
-	len = roundup(len, 4);
-	ret = mt7601u_vendor_single_wr(dev, MT_VEND_WRITE_FCE,
-				       MT_FCE_DMA_LEN, len << 16);
+	ret = mt7601u_fw_fce_wr(dev, MT_FCE_DMA_LEN,
+				roundup(chunk->len, 4) << 16,
+				&fw_dma->fce_len, valid);
 	if (ret)
 		return ret;
 
-	buf.len = MT_DMA_HDR_LEN + len + 4;
-	ret = mt7601u_usb_submit_buf(dev, USB_DIR_OUT, MT_EP_OUT_INBAND_CMD,
-				     &buf, GFP_KERNEL,
-				     mt7601u_complete_urb, &cmpl);
-	if (ret)
-		return ret;
+	fw_dma->fce_valid = true;
+	return 0;
+}
 
-	if (!wait_for_completion_timeout(&cmpl, msecs_to_jiffies(1000))) {
+static int mt7601u_fw_wait_chunk(struct mt7601u_dev *dev,
+				 struct mt7601u_fw_dma *fw_dma,
+				 struct mt7601u_dma_buf *buf)
+{
+	if (!wait_for_completion_timeout(&fw_dma->cmpl,
+					 msecs_to_jiffies(1000))) {
 		dev_err(dev->dev, "Error: firmware upload timed out\n");
-		usb_kill_urb(buf.urb);
+		usb_kill_urb(buf->urb);
 		return -ETIMEDOUT;
 	}
-	if (mt7601u_urb_has_error(buf.urb)) {
+	if (mt7601u_urb_has_error(buf->urb)) {
 		dev_err(dev->dev, "Error: firmware upload urb failed:%d\n",
-			buf.urb->status);
-		return buf.urb->status;
+			buf->urb->status);
+		return buf->urb->status;
 	}
 
-	val = mt7601u_rr(dev, MT_TX_CPU_FROM_FCE_CPU_DESC_IDX);
-	val++;
-	mt7601u_wr(dev, MT_TX_CPU_FROM_FCE_CPU_DESC_IDX, val);
-
 	return 0;
 }
 
 static int
-mt7601u_dma_fw(struct mt7601u_dev *dev, struct mt7601u_dma_buf *dma_buf,
-	       const void *data, int len, u32 dst_addr)
+mt7601u_dma_fw(struct mt7601u_dev *dev, struct mt7601u_fw_dma *fw_dma,
+	       const struct mt7601u_fw_seg *segs, int n_segs)
 {
-	int n, ret;
+	struct mt7601u_fw_seg chunk, next;
+	ktime_t start, t0, t1, t2;
+	int seg = 0, cur = 0, n = 0, ret;
+	u32 off = 0, bytes = 0;
+	bool more;
 
-	if (len == 0)
-		return 0;
+	start = ktime_get();
 
-	n = min(MCU_FW_URB_MAX_PAYLOAD, len);
-	ret = __mt7601u_dma_fw(dev, dma_buf, data, n, dst_addr);
-	if (ret)
-		return ret;
+	more = mt7601u_fw_next_chunk(segs, n_segs, &seg, &off, &chunk);
+	if (more)
+		mt7601u_fw_fill_buf(&fw_dma->buf[cur], &chunk);
 
-	if (!mt76_poll_msec(dev, MT_MCU_COM_REG1, BIT(31), BIT(31), 500))
-		return -ETIMEDOUT;
+	fw_dma->desc_idx = mt7601u_rr(dev, MT_TX_CPU_FROM_FCE_CPU_DESC_IDX);
+
+	while (more) {
+		/* we need to fake length */
+		struct mt7601u_dma_buf buf = fw_dma->buf[cur];
+
+		t0 = ktime_get();
+
+		ret = mt7601u_fw_setup_chunk(dev, fw_dma, &chunk);
+		if (ret)
+			return ret;
+
+		reinit_completion(&fw_dma->cmpl);
+		buf.len = MT_DMA_HDR_LEN + roundup(chunk.len, 4) + 4;
+		ret = mt7601u_usb_submit_buf(dev, USB_DIR_OUT,
+					     MT_EP_OUT_INBAND_CMD, &buf,
+					     GFP_KERNEL, mt7601u_complete_urb,
+					     &fw_dma->cmpl);
+		if (ret)
+			return ret;
+
+		t1 = ktime_get();
+
+		/* Prepare the next chunk while this one is on the wire */
+		more = mt7601u_fw_next_chunk(segs, n_segs, &seg, &off, &next);
+		if (more)
+			mt7601u_fw_fill_buf(&fw_dma->buf[cur ^ 1], &next);
+
+		ret = mt7601u_fw_wait_chunk(dev, fw_dma, &buf);
+		if (ret)
+			return ret;
+
+		t2 = ktime_get();
+
+		mt7601u_wr(dev, MT_TX_CPU_FROM_FCE_CPU_DESC_IDX,
+			   ++fw_dma->desc_idx);
+
+		if (!mt76_poll_msec(dev, MT_MCU_COM_REG1, BIT(31), BIT(31), 500))
+			return -ETIMEDOUT;
+
+		trace_mt_fw_chunk(dev, chunk.dst, chunk.len,
+				  ktime_us_delta(t1, t0),
+				  ktime_us_delta(t2, t1),
+				  ktime_us_delta(ktime_get(), t2));
 
-	return mt7601u_dma_fw(dev, dma_buf, data + n, len - n, dst_addr + n);
+		bytes += chunk.len;
+		n++;
+		if (more)
+			chunk = next;
+		cur ^= 1;
+	}
+
+	trace_mt_fw_upload(dev, bytes, n, ktime_us_delta(ktime_get(), start));
+
+	return 0;
 }
 
 static int
 mt7601u_upload_firmware(struct mt7601u_dev *dev, const struct mt76_fw *fw)
 {
-	struct mt7601u_dma_buf dma_buf;
+	struct mt7601u_fw_dma *fw_dma;
+	struct mt7601u_fw_seg segs[2];
 	void *ivb;
 	u32 ilm_len, dlm_len;
 	int i, ret;
 
 	ivb = kmemdup(fw->ivb, sizeof(fw->ivb), GFP_KERNEL);
-	if (!ivb || mt7601u_usb_alloc_buf(dev, MCU_FW_URB_SIZE, &dma_buf)) {
+	fw_dma = kzalloc(sizeof(*fw_dma), GFP_KERNEL);
+	if (!ivb || !fw_dma) {
 		ret = -ENOMEM;
 		goto error;
 	}
 
+	init_completion(&fw_dma->cmpl);
+	for (i = 0; i < MCU_FW_BUFS; i++)
+		if (mt7601u_usb_alloc_buf(dev, MCU_FW_URB_SIZE,
+					  &fw_dma->buf[i])) {
+			ret = -ENOMEM;
+			goto error;
+		}
+
 	ilm_len = le32_to_cpu(fw->hdr.ilm_len) - sizeof(fw->ivb);
 	dev_dbg(dev->dev, "loading FW - ILM %u + IVB %zu\n",
 		ilm_len, sizeof(fw->ivb));
-	ret = mt7601u_dma_fw(dev, &dma_buf, fw->ilm, ilm_len, sizeof(fw->ivb));
-	if (ret)
-		goto error;
+	segs[0].data = fw->ilm;
+	segs[0].len = ilm_len;
+	segs[0].dst = sizeof(fw->ivb);
 
 	dlm_len = le32_to_cpu(fw->hdr.dlm_len);
 	dev_dbg(dev->dev, "loading FW - DLM %u\n", dlm_len);
-	ret = mt7601u_dma_fw(dev, &dma_buf, fw->ilm + ilm_len,
-			     dlm_len, MT_MCU_DLM_OFFSET);
+	segs[1].data = fw->ilm + ilm_len;
+	segs[1].len = dlm_len;
+	segs[1].dst = MT_MCU_DLM_OFFSET;
+
+	ret = mt7601u_dma_fw(dev, fw_dma, segs, ARRAY_SIZE(segs));
 	if (ret)
 		goto error;
 
@@ -397,7 +1009,11 @@ mt7601u_upload_firmware(struct mt7601u_dev *dev, const struct mt76_fw *fw)
 	dev_dbg(dev->dev, "Firmware running!\n");
 error:
 	kfree(ivb);
-	mt7601u_usb_free_buf(dev, &dma_buf);
+	if (fw_dma) {
+		for (i = 0; i < MCU_FW_BUFS; i++)
+			mt7601u_usb_free_buf(dev, &fw_dma->buf[i]);
+		kfree(fw_dma);
+	}
 
 	return ret;
 }
@@ -492,6 +1108,8 @@ int mt7601u_mcu_init(struct mt7601u_dev *dev)
 	int ret;
 
 	mutex_init(&dev->mcu.mutex);
+	spin_lock_init(&dev->mcu.lock);
+	init_waitqueue_head(&dev->mcu.seq_wait);
 
 	ret = mt7601u_load_firmware(dev);
 	if (ret)
@@ -510,15 +1128,12 @@ int mt7601u_mcu_cmd_init(struct mt7601u_dev *dev)
 	if (ret)
 		return ret;
 
-	init_completion(&dev->mcu.resp_cmpl);
 	if (mt7601u_usb_alloc_buf(dev, MCU_RESP_URB_SIZE, &dev->mcu.resp)) {
 		mt7601u_usb_free_buf(dev, &dev->mcu.resp);
 		return -ENOMEM;
 	}
 
-	ret = mt7601u_usb_submit_buf(dev, USB_DIR_IN, MT_EP_IN_CMD_RESP,
-				     &dev->mcu.resp, GFP_KERNEL,
-				     mt7601u_complete_urb, &dev->mcu.resp_cmpl);
+	ret = mt7601u_mcu_resp_submit(dev, GFP_KERNEL);
 	if (ret) {
 		mt7601u_usb_free_buf(dev, &dev->mcu.resp);
 		return ret;
@@ -530,5 +1145,23 @@ int mt7601u_mcu_cmd_init(struct mt7601u_dev *dev)
 void mt7601u_mcu_cmd_deinit(struct mt7601u_dev *dev)
 {
 	usb_kill_urb(dev->mcu.resp.urb);
+	clear_bit(MT7601U_STATE_MCU_RESP_STOPPED, &dev->state);
+	mt7601u_mcu_cmd_fail_all(dev, -ESHUTDOWN);
 	mt7601u_usb_free_buf(dev, &dev->mcu.resp);
 }
+
+void mt7601u_mcu_cmd_suspend(struct mt7601u_dev *dev)
+{
+	usb_kill_urb(dev->mcu.resp.urb);
+	clear_bit(MT7601U_STATE_MCU_RESP_STOPPED, &dev->state);
+	mt7601u_mcu_cmd_fail_all(dev, -ESHUTDOWN);
+}
+
+/* Resubmit the response URB if the firmware survived suspend. */
+int mt7601u_mcu_cmd_resume(struct mt7601u_dev *dev)
+{
+	if (!firmware_running(dev))
+		return -ENODEV;
+
+	return mt7601u_mcu_resp_submit(dev, GFP_KERNEL);
+}
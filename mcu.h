@@ -15,6 +15,9 @@
 #ifndef __MT7601U_MCU_H
 #define __MT7601U_MCU_H
 
+#include <linux/completion.h>
+#include <linux/ktime.h>
+
 struct mt7601u_dev;
 
 /* Register definitions */
@@ -83,9 +86,32 @@ enum mcu_calibrate {
 	MCU_CAL_TXDCOC,
 };
 
+#define MT_MCU_RESP_TIMEOUT_MS		1500
+
+/**
+ * struct mt7601u_mcu_cmd - MCU command waiting for response
+ * @cmpl:	completed by response handler (or on timeout/shutdown).
+ * @start:	submission time, for latency accounting.
+ * @ret:	result of the command, valid once @cmpl is done.
+ * @seq:	sequence number, 0 if no response is expected.
+ */
+struct mt7601u_mcu_cmd {
+	struct completion cmpl;
+	ktime_t start;
+	int ret;
+	u8 seq;
+};
+
 int mt7601u_mcu_init(struct mt7601u_dev *dev);
 int mt7601u_mcu_cmd_init(struct mt7601u_dev *dev);
 void mt7601u_mcu_cmd_deinit(struct mt7601u_dev *dev);
+void mt7601u_mcu_cmd_suspend(struct mt7601u_dev *dev);
+int mt7601u_mcu_cmd_resume(struct mt7601u_dev *dev);
+
+struct sk_buff;
+int mt7601u_mcu_cmd_submit(struct mt7601u_dev *dev, struct sk_buff *skb,
+			   enum mcu_cmd cmd, struct mt7601u_mcu_cmd *c);
+int mt7601u_mcu_cmd_wait(struct mt7601u_dev *dev, struct mt7601u_mcu_cmd *c);
 
 int
 mt7601u_mcu_calibrate(struct mt7601u_dev *dev, enum mcu_calibrate cal, u32 val);
@@ -20,23 +20,45 @@
 #include <linux/mutex.h>
 #include <linux/usb.h>
 #include <linux/completion.h>
+#include <linux/interrupt.h>
 #include <net/mac80211.h>
 #include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/ktime.h>
+#include <linux/seqlock.h>
 
 #include "regs.h"
 #include "util.h"
 
 #define MT_CALIBRATE_INTERVAL		(4 * HZ)
+#define MT_CAL_STEP_DELAY		msecs_to_jiffies(10)
+#define MT_MAC_WORK_MS			10000
+#define MT_MAC_WORK_MIN_MS		100
 
 #define MT_FREQ_CAL_INIT_DELAY		(30 * HZ)
 #define MT_FREQ_CAL_CHECK_INTERVAL	(10 * HZ)
 #define MT_FREQ_CAL_ADJ_INTERVAL	(HZ / 2)
 
+#define MT_TX_STAT_BATCH		16
+#define MT_TX_STAT_POLL_MS		2
+#define MT_TX_STAT_POLL_MAX_MS		8
+#define MT_TX_STATUS_TIMEOUT		(HZ / 10)
+#define MT_TX_PENDING_MAX		64
+
 #define MT_BBP_REG_VERSION		0x00
 
 #define MT_USB_AGGR_SIZE_LIMIT		21 /* * 1024B */
 #define MT_USB_AGGR_TIMEOUT		0x80 /* * 33ns */
-#define MT_RX_URB_SIZE			(24 * 1024)
+#define MT_USB_AGGR_TIMEOUT_MIN		0x10
+#define MT_USB_AGGR_TIMEOUT_MAX		0xff
+#define MT_RX_ORDER			3
+#define MT_RX_ORDER_MIN			1
+#define MT_RX_ORDER_MAX			4
+
+#define MT_RX_AGGR_INTERVAL		(HZ / 2)
+#define MT_RX_AGGR_LIGHT_BYTES		(64 << 10) /* per interval */
+#define MT_RX_AGGR_BUSY_BYTES		(1 << 20) /* per interval */
 
 struct mt7601u_dma_buf {
 	struct urb *urb;
@@ -45,13 +67,29 @@ struct mt7601u_dma_buf {
 	size_t len;
 };
 
+#define MT_MCU_SEQ_MAX		16
+
+struct mt7601u_mcu_cmd;
+
+/**
+ * struct mt7601u_mcu - MCU command path state
+ * @mutex:	serializes sending commands on the in-band command endpoint.
+ * @lock:	protects @msg_seq and @pending.
+ * @msg_seq:	last sequence number handed out.
+ * @pending:	commands waiting for response, indexed by sequence number.
+ * @seq_wait:	woken up when an entry in @pending frees up.
+ * @resp:	response URB, resubmitted from its completion, if that fails
+ *		next mt7601u_mcu_cmd_submit() rearms it.
+ */
 struct mt7601u_mcu {
 	struct mutex mutex;
+	spinlock_t lock;
 
 	u8 msg_seq;
+	struct mt7601u_mcu_cmd *pending[MT_MCU_SEQ_MAX];
+	wait_queue_head_t seq_wait;
 
 	struct mt7601u_dma_buf resp;
-	struct completion resp_cmpl;
 };
 
 struct mt7601u_freq_cal {
@@ -69,33 +107,173 @@ struct mac_stats {
 	u64 zero_len_del[2];
 };
 
+#define MT_RX_POLL_BUDGET	64
+#define MT_RX_POLL_HIST_LEN	8
+
+struct mt7601u_rx_poll_stats {
+	u64 polls;
+	u64 frames;
+	u64 budget_exhausted;
+	u64 hist[MT_RX_POLL_HIST_LEN];
+};
+
+enum mt7601u_sw_stat {
+	MT_SW_STAT_RX_URBS,
+	MT_SW_STAT_RX_SEGS,
+	MT_SW_STAT_RX_URB_ERR,
+	MT_SW_STAT_RX_SUBMIT_ERR,
+	MT_SW_STAT_RX_PAGE_ALLOC_FAIL,
+	MT_SW_STAT_RX_SKB_ALLOC_FAIL,
+	MT_SW_STAT_RX_BAD_FRAME,
+	MT_SW_STAT_TX_URB_ERR,
+	MT_SW_STAT_TX_SUBMIT_ERR,
+	MT_SW_STAT_TX_QUEUE_STOP,
+	MT_SW_STAT_TX_QUEUE_WAKE,
+	MT_SW_STAT_VEND_REQ_RETRY,
+	MT_SW_STAT_VEND_REQ_FAIL,
+
+	__MT_SW_STAT_MAX
+};
+
+enum mt7601u_lat {
+	MT_LAT_VEND_REQ,
+	MT_LAT_MCU_CMD,
+	MT_LAT_TX_URB,
+	MT_LAT_RX_TURNAROUND,
+
+	__MT_LAT_MAX
+};
+
+/* Bucket 0 counts events shorter than 1us, bucket i > 0 events which took
+ * [2^(i-1), 2^i) us, the last one is open-ended.
+ */
+#define MT_LAT_HIST_LEN		21
+
+struct mt7601u_lat_stats {
+	u64 hist[__MT_LAT_MAX][MT_LAT_HIST_LEN];
+	u64 sum_us[__MT_LAT_MAX];
+};
+
+/**
+ * struct mt7601u_sw_stats - per-CPU counters of driver hot paths
+ * @cnt:	counters indexed by &enum mt7601u_sw_stat.
+ * @lat:	latency histograms indexed by &enum mt7601u_lat.
+ * @syncp:	makes 64-bit counters readable on 32-bit hosts.
+ *
+ * Note: counters are only ever updated with IRQs disabled on the local CPU
+ *	 (see mt7601u_sw_stat_add()), so no other locking is needed and
+ *	 readers just sum all CPUs.
+ */
+struct mt7601u_sw_stats {
+	u64 cnt[__MT_SW_STAT_MAX];
+	struct mt7601u_lat_stats lat;
+	struct u64_stats_sync syncp;
+};
+
+/**
+ * struct mt7601u_rx_aggr - USB RX bulk aggregation control
+ * @tout:	aggregation timeout (in 33ns units) to be programmed.
+ * @lmt:	aggregation size limit (in KiB) to be programmed.
+ * @lmt_max:	largest limit which still leaves room for a frame in the URB.
+ * @manual:	don't adapt @tout and @lmt to traffic, only program them.
+ * @hw_tout:	timeout currently programmed, protected by @mutex.
+ * @hw_lmt:	limit currently programmed, protected by @mutex.
+ * @urbs:	number of received URBs, updated by RX tasklet.
+ * @bytes:	number of bytes received in URBs, updated by RX tasklet.
+ */
+struct mt7601u_rx_aggr {
+	u32 tout;
+	u32 lmt;
+	u32 lmt_max;
+	u32 manual;
+
+	u32 hw_tout;
+	u32 hw_lmt;
+
+	u32 urbs;
+	u32 bytes;
+	u32 last_urbs;
+	u32 last_bytes;
+};
+
 #define N_RX_ENTRIES	64
 struct mt7601u_rx_queue {
 	struct mt7601u_dev *dev;
 
-	struct mt7601u_dma_buf e[N_RX_ENTRIES];
+	struct mt7601u_dma_buf_rx {
+		struct urb *urb;
+		struct page *p;
+		ktime_t done;
+	} e[N_RX_ENTRIES];
 
 	unsigned int start;
 	unsigned int end;
 	unsigned int entries;
 	unsigned int pending;
+	unsigned int order;
+
+	u32 budget;
+	struct mt7601u_rx_poll_stats poll_stats;
 };
 
 #define N_TX_ENTRIES	64
+#define MT_TX_RING_MIN	16
+#define MT_TX_RING_MAX	512
+
+#define MT_TX_AGGR_MAX_FRAMES		8
+#define MT_TX_AGGR_FRAME_MAX_LEN	512
+#define MT_TX_AGGR_BUF_LEN		4096
+#define MT_TX_AGGR_BUFS			4
+#define MT_TX_AGGR_TIMEOUT_US		200
+
+struct mt7601u_tx_aggr_stats {
+	u64 urbs;
+	u64 frames;
+	u64 hist[MT_TX_AGGR_MAX_FRAMES];
+};
 
+/**
+ * struct mt7601u_tx_queue - TX ring of one USB OUT endpoint
+ * @e:			ring entries, an entry carries either a single @skb
+ *			or frames from @aggr copied into one of @aggr_bufs.
+ *			Allocated on first use of the endpoint, until then
+ *			frames are parked on @aggr_pending.
+ * @alloc_req:		allocation of the ring has been requested.
+ * @bytes:		length of frames on the ring and on @aggr_pending.
+ * @aggr_pending:	small frames waiting to be packed into one URB.
+ * @aggr_len:		transfer length of frames on @aggr_pending.
+ * @aggr_timer:		flushes @aggr_pending if no URB completes in time.
+ * @aggr_buf_free:	bitmap of unused @aggr_bufs.
+ */
 struct mt7601u_tx_queue {
 	struct mt7601u_dev *dev;
 
 	struct mt7601u_dma_buf_tx {
 		struct urb *urb;
 		struct sk_buff *skb;
-	} e[N_TX_ENTRIES];
+		struct sk_buff_head aggr;
+		int aggr_buf;
+		ktime_t submitted;
+	} *e;
+	bool alloc_req;
 
 	unsigned int start;
 	unsigned int end;
 	unsigned int entries;
 	unsigned int used;
+	unsigned int used_max;
 	unsigned int fifo_seq;
+	unsigned int bytes;
+
+	struct sk_buff_head aggr_pending;
+	unsigned int aggr_len;
+	struct tasklet_hrtimer aggr_timer;
+
+	struct mt7601u_tx_aggr_buf {
+		void *buf;
+		dma_addr_t dma;
+	} aggr_bufs[MT_TX_AGGR_BUFS];
+	unsigned long aggr_buf_free;
 };
 
 /* WCID allocation:
@@ -113,6 +291,20 @@ struct mt7601u_eeprom_params;
 #define MT_EE_TEMPERATURE_SLOPE		39
 #define MT_FREQ_OFFSET_INVALID		-128
 
+/* Layout of mt7601u_dev->bcn_mon */
+#define MT_BCN_MON_FREQ_OFF		GENMASK(7, 0)
+#define MT_BCN_MON_PHY_MODE		GENMASK(15, 8)
+
+/**
+ * struct mt7601u_bssid - RCU-published BSSID of the AP we are connected to
+ * @addr:	the BSSID.
+ * @rcu_head:	for freeing after RX path is done with it.
+ */
+struct mt7601u_bssid {
+	u8 addr[ETH_ALEN];
+	struct rcu_head rcu_head;
+};
+
 enum mt_temp_mode {
 	MT_TEMP_MODE_NORMAL,
 	MT_TEMP_MODE_HIGH,
@@ -130,23 +322,273 @@ enum {
 	MT7601U_STATE_WLAN_RUNNING,
 	MT7601U_STATE_MCU_RUNNING,
 	MT7601U_STATE_SCANNING,
+	MT7601U_STATE_OFFCHANNEL,
 	MT7601U_STATE_READING_STATS,
 	MT7601U_STATE_MORE_STATS,
+	MT7601U_STATE_STARTED,
+	MT7601U_STATE_MCU_RESP_STOPPED,
+};
+
+#define MT_CHAN_CAL_TEMP_DELTA	8
+
+/**
+ * struct mt7601u_chan_cache - hardware state left by last channel switch
+ * @valid:	cache was initialized since last PHY init.
+ * @lna_set:	BBP R62-R64 LNA gain compensation was written.
+ * @tx_alc_cfg_0: value of MT_TX_ALC_CFG_0.
+ * @tx_pwr_cfg_0: value of MT_TX_PWR_CFG_0 written on channel switch.
+ * @ch14:	CH14 OBW fixup state, -1 if unknown.
+ * @cal_bw:	bandwidth BW filter was calibrated for, -1 if not calibrated.
+ * @cal_temp:	raw temperature at the time of BW filter calibration.
+ *
+ * Only what differs from the current hardware state is programmed on
+ * channel switch, BW filter calibration depends only on the bandwidth and
+ * is repeated when bandwidth changes or temperature drifts.
+ */
+struct mt7601u_chan_cache {
+	bool valid;
+	bool lna_set;
+	u32 tx_alc_cfg_0;
+	u32 tx_pwr_cfg_0;
+	s8 ch14;
+	s8 cal_bw;
+	s8 cal_temp;
+};
+
+#define MT_BBP_SHADOW_REGS		256
+#define MT_RF_SHADOW_BANKS		16
+#define MT_RF_SHADOW_REGS		64
+
+/**
+ * struct mt7601u_reg_shadow - write-through cache of BBP and RF registers
+ * @bbp:	last value written to or read from each BBP register.
+ * @rf:		same as @bbp for RF registers, indexed by bank and offset.
+ * @bbp_valid:	marks entries of @bbp which can be trusted.
+ * @rf_valid:	marks entries of @rf which can be trusted.
+ * @hits:	reads served from the cache.
+ * @misses:	reads which had to go to the device.
+ *
+ * Protected by reg_atomic_mutex.  Registers which change on their own
+ * (readbacks, self-clearing triggers) are never cached.  Whole cache is
+ * dropped on BBP reset, resume and after MCU calibrations, since those
+ * change registers behind driver's back.
+ */
+struct mt7601u_reg_shadow {
+	u8 bbp[MT_BBP_SHADOW_REGS];
+	u8 rf[MT_RF_SHADOW_BANKS][MT_RF_SHADOW_REGS];
+	DECLARE_BITMAP(bbp_valid, MT_BBP_SHADOW_REGS);
+	DECLARE_BITMAP(rf_valid, MT_RF_SHADOW_BANKS * MT_RF_SHADOW_REGS);
+	u64 hits;
+	u64 misses;
+};
+
+enum mt7601u_prof_type {
+	MT_PROF_RR,
+	MT_PROF_WR,
+	MT_PROF_RMW,
+	MT_PROF_RR_SPAN,
+	MT_PROF_POLL,
+	MT_PROF_VEND,
+	MT_PROF_RF,
+	MT_PROF_BBP,
+	MT_PROF_MCU,
+
+	__MT_PROF_MAX
+};
+
+#define MT_PROF_SITES		128
+#define MT_PROF_TASKS		4
+#define MT_PROF_TOP		32
+
+struct mt7601u_prof_site {
+	unsigned long ip;
+	enum mt7601u_prof_type type;
+	u64 cnt;
+	u64 ns;
+};
+
+/**
+ * struct mt7601u_reg_prof - per-call-site profile of register accesses
+ * @enabled:	set via debugfs, nothing is recorded unless non-zero.
+ * @lock:	protects all other fields.
+ * @task:	tasks inside a profiled access, nested accesses (e.g. the
+ *		reads done by a poll) are accounted to the outermost one.
+ * @depth:	nesting level of @task.
+ * @sites:	hash table of call sites, keyed by caller and access type.
+ * @dropped:	accesses not recorded because @sites was full.
+ */
+struct mt7601u_reg_prof {
+	u32 enabled;
+	spinlock_t lock;
+	struct task_struct *task[MT_PROF_TASKS];
+	int depth[MT_PROF_TASKS];
+	struct mt7601u_prof_site sites[MT_PROF_SITES];
+	u64 dropped;
+};
+
+struct mt7601u_prof_ctx {
+	ktime_t start;
+	int slot;
+	bool outer;
+};
+
+enum mt7601u_cal_step {
+	MT_CAL_STEP_AGC,
+	MT_CAL_STEP_TSSI,
+	MT_CAL_STEP_TEMP_KICK,
+	MT_CAL_STEP_TEMP_READ,
+	MT_CAL_STEP_TEMP_COMP,
+
+	__MT_CAL_STEP_MAX
+};
+
+/**
+ * struct mt7601u_cal_state - progress of periodic calibration
+ * @step:	next &enum mt7601u_cal_step to run.
+ * @agc_valid:	@agc_bucket reflects what is programmed in BBP R66.
+ * @agc_bucket:	RSSI bucket AGC was last tuned for.
+ * @comp_valid:	@comp_temp reflects last temperature compensation.
+ * @comp_temp:	raw temperature temperature compensation last ran for.
+ *
+ * Periodic calibration runs one step per cal_work invocation and yields
+ * for %MT_CAL_STEP_DELAY between steps, steps whose inputs didn't change
+ * since they last ran are skipped.
+ */
+struct mt7601u_cal_state {
+	u8 step;
+	bool agc_valid;
+	u8 agc_bucket;
+	bool comp_valid;
+	s8 comp_temp;
+};
+
+#define MT_PS_WAKE_GUARD_US		2000
+#define MT_PS_MIN_SLEEP_US		5000
+#define MT_PS_BCN_GRACE			msecs_to_jiffies(2)
+#define MT_PS_BCN_TIMEOUT		msecs_to_jiffies(20)
+
+#define MT_PS_BCN_DTIM_COUNT		GENMASK(7, 0)
+#define MT_PS_BCN_DTIM_PERIOD		GENMASK(15, 8)
+#define MT_PS_BCN_VALID			BIT(16)
+
+enum mt7601u_ps_retrieve {
+	MT_PS_RETRIEVE_UC,
+	MT_PS_RETRIEVE_MC,
+};
+
+/**
+ * struct mt7601u_ps - state of powersave
+ * @enabled:	mac80211 requested PS, written under @mutex, read by RX path.
+ * @dozing:	MAC RX, RX URBs and periodic works are stopped.
+ * @aid:	our AID, for checking the TIM in RX path.
+ * @beacon_int:	beacon interval of the BSS in TU.
+ * @bcn:	DTIM count and period from the last beacon, see %MT_PS_BCN_*,
+ *		written by RX path, cleared on wake up.
+ * @retrieve:	buffered traffic announced by the last beacon which hasn't
+ *		been received yet, bits of &enum mt7601u_ps_retrieve, RX path.
+ * @deadline:	time by which a beacon should have been received after
+ *		wake up, dozing with unknown DTIM phase after that.
+ * @work:	decides when and for how long to doze.
+ * @wake_work:	brings the device back from doze.
+ * @timer:	fires %MT_PS_WAKE_GUARD_US before the TBTT to wake up for.
+ * @mac_due:	when @mac_work was due at the time it was paused.
+ * @cal_due:	when @cal_work was due at the time it was paused.
+ * @freq_cal_due: when @freq_cal work was due at the time it was paused.
+ *
+ * All fields except @bcn and the works are protected by @mutex.
+ */
+struct mt7601u_ps {
+	bool enabled;
+	bool dozing;
+	u16 aid;
+	u16 beacon_int;
+	atomic_t bcn;
+	unsigned long retrieve;
+	unsigned long deadline;
+
+	struct delayed_work work;
+	struct work_struct wake_work;
+	struct hrtimer timer;
+
+	unsigned long mac_due;
+	unsigned long cal_due;
+	unsigned long freq_cal_due;
+};
+
+#define MT_SCAN_ACTIVE_DWELL		msecs_to_jiffies(40)
+#define MT_SCAN_PASSIVE_DWELL		msecs_to_jiffies(110)
+#define MT_SCAN_OPER_DWELL		msecs_to_jiffies(100)
+#define MT_SCAN_CHANS_PER_VISIT		3
+#define MT_SCAN_DRAIN_MS		20
+#define MT_SCAN_MAX_SSIDS		4
+#define MT_SCAN_MAX_IE_LEN		256
+
+/**
+ * struct mt7601u_scan - state of driver-run (hw_scan) scan
+ * @work:	scan step work.
+ * @vif:	interface which requested the scan.
+ * @req:	scan request, NULL if no scan is running.
+ * @ies:	IEs to be added to probe requests.
+ * @oper:	operating channel to return to.
+ * @chan_idx:	index of the next channel in @req to visit.
+ * @since_oper:	number of channels scanned since leaving @oper.
+ * @on_oper:	device is tuned to @oper.
+ * @abort:	mac80211 asked to cancel the scan.
+ */
+struct mt7601u_scan {
+	struct delayed_work work;
+	struct ieee80211_vif *vif;
+	struct cfg80211_scan_request *req;
+	struct ieee80211_scan_ies *ies;
+	struct cfg80211_chan_def oper;
+	int chan_idx;
+	int since_oper;
+	bool on_oper;
+	bool abort;
 };
 
 /**
  * struct mt7601u_dev - adapter structure
- * @lock:		protects @wcid->tx_rate.
- * @tx_lock:		protects @tx_q and changes of MT7601U_STATE_*_STATS
+ * @lock:		serializes updates of @wcid->tmpl, protects per-station
+ *			AMPDU controller state.
+ * @tx_lock:		protects @tx_q, @tx_pending, @tx_aggr_stats,
+			@tx_stat_poll_ms and changes of MT7601U_STATE_*_STATS
 			flags in @state.
+ * @txq_lock:		protects @txq_list.
  * @rx_lock:		protects @rx_q.
- * @con_mon_lock:	protects @ap_bssid, @bcn_*, @avg_rssi.
  * @mutex:		ensures exclusive access from mac80211 callbacks.
- * @vendor_req_mutex:	ensures atomicity of vendor requests.
+ * @vendor_req_mutex:	ensures atomicity of vendor requests, protects
+ *			@vend_buf, @vend_req_cnt, @vend_multi_wr_ok,
+ *			@vend_no_multi_wr, @vend_multi_rd_ok and
+ *			@vend_no_multi_rd.
+ * @vend_buf:		DMA-able bounce buffer for register writes.
+ * @vend_multi_wr_ok:	device accepted MULTI_WRITE at least once, later
+ *			failures are treated as transient.
+ * @vend_no_multi_wr:	device rejected MULTI_WRITE, use 16-bit writes.
+ * @vend_multi_rd_ok:	device returned a whole MULTI_READ span at least
+ *			once, later failures are treated as transient.
+ * @vend_no_multi_rd:	device rejected MULTI_READ of a span, read
+ *			registers one by one.
  * @reg_atomic_mutex:	ensures atomicity of indirect register accesses
  *			(accesses to RF and BBP).
  * @hw_atomic_mutex:	ensures exclusive access to HW during critical
  *			operations (power management, channel switch).
+ * @mac_work_ms:	period of MAC counter sweep in @mac_work.
+ * @ampdu_factor:	AMPDU factor programmed into MT_MAX_LEN_CFG, largest
+ *			across stations, protected by @mutex.
+ * @sw_stats:		per-CPU counters of driver events, lockless.
+ * @stat_wq:		per-device high priority workqueue for TX status
+ *			polling and TX ring allocation.
+ * @io_wq:		per-device workqueue running RX and TX scheduling
+ *			instead of tasklets, NULL unless threaded_io is set.
+ *			Both are exposed in sysfs so their CPU affinity can
+ *			be set per adapter.
+ * @init_done:		completed once @init_work (or synchronous probe) has
+ *			finished HW init, successful or not.
+ * @lat_base:		snapshot of @sw_stats latency histograms taken on
+ *			reset via debugfs, protected by @mutex.
+ * @rx_bench:		RX path is running synthetic benchmark URBs, don't
+ *			account them in @sw_stats and @rx_aggr.
  */
 struct mt7601u_dev {
 	struct ieee80211_hw *hw;
@@ -165,9 +607,12 @@ struct mt7601u_dev {
 
 	struct delayed_work cal_work;
 	struct delayed_work mac_work;
+	u32 mac_work_ms;
 
 	struct workqueue_struct *stat_wq;
+	struct workqueue_struct *io_wq;
 	struct delayed_work stat_work;
+	u8 tx_stat_poll_ms;
 
 	struct mt76_wcid *mon_wcid;
 	struct mt76_wcid __rcu *wcid[N_WCIDS];
@@ -183,6 +628,13 @@ struct mt7601u_dev {
 	struct mutex reg_atomic_mutex;
 	struct mutex hw_atomic_mutex;
 
+	__le32 *vend_buf;
+	u64 vend_req_cnt;
+	bool vend_multi_wr_ok;
+	bool vend_no_multi_wr;
+	bool vend_multi_rd_ok;
+	bool vend_no_multi_rd;
+
 	u32 rxfilter;
 	u32 debugfs_reg;
 
@@ -194,22 +646,48 @@ struct mt7601u_dev {
 	/* TX */
 	spinlock_t tx_lock;
 	struct mt7601u_tx_queue *tx_q;
+	struct sk_buff_head tx_pending;
+
+	u32 tx_aggr_max;
+	struct mt7601u_tx_aggr_stats tx_aggr_stats;
+	struct mt7601u_sw_stats __percpu *sw_stats;
+	struct mt7601u_lat_stats lat_base;
+
+	spinlock_t txq_lock;
+	struct list_head txq_list[IEEE80211_NUM_ACS];
+	struct tasklet_struct tx_tasklet;
+	struct work_struct tx_work;
+	u32 tx_byte_limit;
+	struct work_struct tx_alloc_work;
+
+	struct work_struct init_work;
+	struct completion init_done;
+
+	struct mt7601u_pm_state pm;
+
+	struct mt7601u_scan scan;
+	struct mt7601u_ps ps;
 
 	atomic_t avg_ampdu_len;
+	u8 ampdu_factor;
 
 	/* RX */
 	spinlock_t rx_lock;
 	struct tasklet_struct rx_tasklet;
+	struct work_struct rx_work;
 	struct mt7601u_rx_queue rx_q;
+	struct mt7601u_rx_aggr rx_aggr;
+	struct delayed_work rx_aggr_work;
+	bool rx_bench;
 
-	/* Connection monitoring things */
-	spinlock_t con_mon_lock;
-	u8 ap_bssid[ETH_ALEN];
-
-	s8 bcn_freq_off;
-	u8 bcn_phy_mode;
+	/* Connection monitoring things, updated locklessly by RX path.
+	 * @ap_bssid is published under @mutex, @bcn_mon packs freq offset
+	 * and PHY mode of the last beacon so they are read together.
+	 */
+	struct mt7601u_bssid __rcu *ap_bssid;
+	atomic_t bcn_mon;
 
-	int avg_rssi; /* starts at 0 and converges */
+	atomic_t avg_rssi; /* starts at 0 and converges */
 
 	u8 agc_save;
 
@@ -231,6 +709,10 @@ struct mt7601u_dev {
 
 	u8 bw;
 	bool chan_ext_below;
+	struct mt7601u_chan_cache chan_cache;
+	struct mt7601u_cal_state cal;
+	struct mt7601u_reg_shadow shadow;
+	struct mt7601u_reg_prof prof;
 
 	/* PA mode */
 	u32 rf_pa_mode[2];
@@ -243,13 +725,36 @@ struct mt7601u_tssi_params {
 	int trgt_power;
 };
 
+/**
+ * struct mt76_wcid_tmpl - per-wcid TXWI fields precomputed off the TX path
+ * @rate_ctl:	TXWI rate from rate table, valid if @rate_set.
+ * @rate_nss:	number of spatial streams of @rate_ctl.
+ * @rate_set:	@rate_ctl was set from rate control's rate table.
+ * @ba_size:	BA window advertised by the peer, for AMPDUs.
+ * @density:	MPDU density required by the peer, for AMPDUs.
+ */
+struct mt76_wcid_tmpl {
+	u16 rate_ctl;
+	u8 rate_nss;
+	bool rate_set;
+	u8 ba_size;
+	u8 density;
+};
+
+/**
+ * struct mt76_wcid - wireless client ID entry
+ * @idx:	WCID index.
+ * @hw_key_idx:	index of HW key, -1 if none.
+ * @tmpl_seq:	lets TX path read @tmpl without locking, writers are
+ *		serialized by dev->lock.
+ * @tmpl:	TXWI template.
+ */
 struct mt76_wcid {
 	u8 idx;
 	u8 hw_key_idx;
 
-	u16 tx_rate;
-	bool tx_rate_set;
-	u8 tx_rate_nss;
+	seqcount_t tmpl_seq;
+	struct mt76_wcid_tmpl tmpl;
 };
 
 struct mt76_vif {
@@ -258,9 +763,55 @@ struct mt76_vif {
 	struct mt76_wcid group_wcid;
 };
 
+#define MT_AMPDU_CTL_MIN_SAMPLES	16
+#define MT_AMPDU_CTL_BAD_PCT		20
+#define MT_AMPDU_CTL_GOOD_PCT		5
+#define MT_AMPDU_CTL_MIN_BA		2
+/* A-MPDU subframe of a full size MSDU: delimiter, QoS header, LLC/SNAP,
+ * CCMP header and MIC, FCS and padding.
+ */
+#define MT_AMPDU_CTL_SUBFRAME_LEN	round_up(4 + 26 + 8 + ETH_DATA_LEN + \
+						 8 + 8 + FCS_LEN, 4)
+
+/**
+ * struct mt7601u_ampdu_ctl - per-link aggregation controller state
+ * @tx:		aggregate statuses received since last controller run.
+ * @retry:	retries reported in those statuses.
+ * @fail:	statuses without ACK.
+ * @ba_cap:	largest BA window allowed by peer's and global AMPDU factor.
+ * @ba_size:	BA window currently used in TXWI.
+ * @density_min: MPDU density required by the peer.
+ * @density:	MPDU density currently used in TXWI.
+ * @bad_pct:	retry + failure percentage seen by the last run.
+ *
+ * Counters are updated from TX status path, the rest is protected by
+ * dev->lock.
+ */
+struct mt7601u_ampdu_ctl {
+	atomic_t tx;
+	atomic_t retry;
+	atomic_t fail;
+
+	u8 ba_cap;
+	u8 ba_size;
+	u8 density_min;
+	u8 density;
+	u8 bad_pct;
+};
+
 struct mt76_sta {
 	struct mt76_wcid wcid;
 	u16 agg_ssn[IEEE80211_NUM_TIDS];
+	struct mt7601u_ampdu_ctl ampdu;
+};
+
+#define MT_TXQ_QUANTUM		1600
+#define MT_TX_BYTE_LIMIT	(32 * 1024)
+
+struct mt76_txq {
+	struct list_head list;
+	struct ieee80211_txq *txq;
+	int deficit;
 };
 
 struct mt76_reg_pair {
@@ -268,6 +819,47 @@ struct mt76_reg_pair {
 	u32 value;
 };
 
+/**
+ * struct mt7601u_reg_prog - one table of a register program
+ * @base:	MCU memory map base added to register addresses in @regs.
+ * @regs:	register/value pairs.
+ * @n:		number of entries in @regs.
+ */
+struct mt7601u_reg_prog {
+	u32 base;
+	const struct mt76_reg_pair *regs;
+	int n;
+};
+
+#define MT_REG_PROG(_base, _regs)	{ _base, _regs, ARRAY_SIZE(_regs) }
+
+#define MT_REG_BATCH_MAX	32
+#define MT_REG_BATCH_MIN_BURST	4
+
+struct mt7601u_reg_batch {
+	struct mt7601u_dev *dev;
+	int n;
+	int ret;
+	struct mt76_reg_pair regs[MT_REG_BATCH_MAX];
+};
+
+#define MT_PM_MAC_REGS		21
+#define MT_PM_BBP_REGS		5
+
+/**
+ * struct mt7601u_pm_state - state kept over light suspend
+ * @light:	DMA and MCU were left set up and chip was not powered down.
+ * @mac:	MAC register values.
+ * @bbp:	BBP register values.
+ *
+ * See mt7601u_suspend_hw() for the register lists.
+ */
+struct mt7601u_pm_state {
+	bool light;
+	u32 mac[MT_PM_MAC_REGS];
+	u8 bbp[MT_PM_BBP_REGS];
+};
+
 struct mt7601u_rxwi;
 
 extern const struct ieee80211_ops mt7601u_ops;
@@ -275,6 +867,7 @@ extern const struct ieee80211_ops mt7601u_ops;
 void mt7601u_init_debugfs(struct mt7601u_dev *dev);
 
 u32 mt7601u_rr(struct mt7601u_dev *dev, u32 offset);
+void mt7601u_rr_span(struct mt7601u_dev *dev, u32 offset, u32 *vals, int n);
 void mt7601u_wr(struct mt7601u_dev *dev, u32 offset, u32 val);
 u32 mt7601u_rmw(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val);
 u32 mt7601u_rmc(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val);
@@ -291,6 +884,89 @@ bool mt76_poll_msec(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val,
 #define mt76_rmw_field(_dev, _reg, _field, _val)	\
 	mt76_rmw(_dev, _reg, _field, MT76_SET(_field, _val))
 
+static inline void
+mt7601u_sw_stat_add(struct mt7601u_dev *dev, enum mt7601u_sw_stat idx, u64 val)
+{
+	struct mt7601u_sw_stats *st;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	st = this_cpu_ptr(dev->sw_stats);
+	u64_stats_update_begin(&st->syncp);
+	st->cnt[idx] += val;
+	u64_stats_update_end(&st->syncp);
+	local_irq_restore(flags);
+}
+
+void mt7601u_sw_stat_sum(struct mt7601u_dev *dev, u64 *sum);
+
+static inline void
+mt7601u_sw_stat_inc(struct mt7601u_dev *dev, enum mt7601u_sw_stat idx)
+{
+	mt7601u_sw_stat_add(dev, idx, 1);
+}
+
+static inline void mt7601u_rx_kick(struct mt7601u_dev *dev)
+{
+	if (dev->io_wq)
+		queue_work(dev->io_wq, &dev->rx_work);
+	else
+		tasklet_schedule(&dev->rx_tasklet);
+}
+
+static inline void mt7601u_tx_kick(struct mt7601u_dev *dev)
+{
+	if (dev->io_wq)
+		queue_work(dev->io_wq, &dev->tx_work);
+	else
+		tasklet_schedule(&dev->tx_tasklet);
+}
+
+/* Account time elapsed since @start in latency histogram @idx. */
+static inline void
+mt7601u_lat_account(struct mt7601u_dev *dev, enum mt7601u_lat idx,
+		    ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	struct mt7601u_sw_stats *st;
+	unsigned long flags;
+	int b;
+
+	if (us < 0)
+		us = 0;
+	b = us ? min_t(int, ilog2(us) + 1, MT_LAT_HIST_LEN - 1) : 0;
+
+	local_irq_save(flags);
+	st = this_cpu_ptr(dev->sw_stats);
+	u64_stats_update_begin(&st->syncp);
+	st->lat.hist[idx][b]++;
+	st->lat.sum_us[idx] += us;
+	u64_stats_update_end(&st->syncp);
+	local_irq_restore(flags);
+}
+
+void __mt7601u_prof_enter(struct mt7601u_dev *dev,
+			  struct mt7601u_prof_ctx *ctx);
+void __mt7601u_prof_exit(struct mt7601u_dev *dev, struct mt7601u_prof_ctx *ctx,
+			 enum mt7601u_prof_type type, unsigned long ip);
+
+static inline void
+mt7601u_prof_enter(struct mt7601u_dev *dev, struct mt7601u_prof_ctx *ctx)
+{
+	ctx->slot = -1;
+	if (READ_ONCE(dev->prof.enabled))
+		__mt7601u_prof_enter(dev, ctx);
+}
+
+/* Account access started by mt7601u_prof_enter() to call site @ip. */
+static inline void
+mt7601u_prof_exit(struct mt7601u_dev *dev, struct mt7601u_prof_ctx *ctx,
+		  enum mt7601u_prof_type type, unsigned long ip)
+{
+	if (ctx->slot >= 0)
+		__mt7601u_prof_exit(dev, ctx, type, ip);
+}
+
 static inline u32 mt76_rr(struct mt7601u_dev *dev, u32 offset)
 {
 	return mt7601u_rr(dev, offset);
@@ -319,27 +995,47 @@ static inline u32 mt76_clear(struct mt7601u_dev *dev, u32 offset, u32 val)
 
 int mt7601u_write_reg_pairs(struct mt7601u_dev *dev, u32 base,
 			    const struct mt76_reg_pair *data, int len);
+int mt7601u_write_reg_prog(struct mt7601u_dev *dev,
+			   const struct mt7601u_reg_prog *prog, int n);
 int mt7601u_burst_write_regs(struct mt7601u_dev *dev, u32 offset,
 			     const u32 *data, int n);
 void mt7601u_addr_wr(struct mt7601u_dev *dev, const u32 offset, const u8 *addr);
 
+void mt7601u_batch_init(struct mt7601u_dev *dev, struct mt7601u_reg_batch *b);
+void mt7601u_batch_wr(struct mt7601u_reg_batch *b, u32 offset, u32 val);
+void mt7601u_batch_bbp_wr(struct mt7601u_reg_batch *b, u8 offset, u8 val);
+void mt7601u_batch_rf_wr(struct mt7601u_reg_batch *b, u8 offset, u8 val);
+u32 mt7601u_batch_rr(struct mt7601u_reg_batch *b, u32 offset);
+u32 mt7601u_batch_rmw(struct mt7601u_reg_batch *b, u32 offset,
+		      u32 mask, u32 val);
+int mt7601u_batch_commit(struct mt7601u_reg_batch *b);
+
 /* Init */
 struct mt7601u_dev *mt7601u_alloc_device(struct device *dev);
 int mt7601u_init_hardware(struct mt7601u_dev *dev);
+int mt7601u_init_early(struct mt7601u_dev *dev);
+void mt7601u_init_work(struct work_struct *work);
 int mt7601u_register_device(struct mt7601u_dev *dev);
 void mt7601u_cleanup(struct mt7601u_dev *dev);
+void mt7601u_suspend_hw(struct mt7601u_dev *dev);
+int mt7601u_resume_hw(struct mt7601u_dev *dev, bool reset);
 
 int mt7601u_mac_start(struct mt7601u_dev *dev);
 void mt7601u_mac_stop(struct mt7601u_dev *dev);
 
 /* PHY */
 int mt7601u_phy_init(struct mt7601u_dev *dev);
+void mt7601u_phy_shadow_reset(struct mt7601u_dev *dev);
+void mt7601u_phy_shadow_update(struct mt7601u_dev *dev, u32 addr, u8 val);
 int mt7601u_wait_bbp_ready(struct mt7601u_dev *dev);
 void mt7601u_set_rx_path(struct mt7601u_dev *dev, u8 path);
 void mt7601u_set_tx_dac(struct mt7601u_dev *dev, u8 path);
 int mt7601u_bbp_set_bw(struct mt7601u_dev *dev, int bw);
 void mt7601u_agc_save(struct mt7601u_dev *dev);
 void mt7601u_agc_restore(struct mt7601u_dev *dev);
+void mt7601u_phy_pm_save(struct mt7601u_dev *dev);
+void mt7601u_phy_pm_restore(struct mt7601u_dev *dev,
+			    struct mt7601u_reg_batch *b);
 int mt7601u_phy_set_channel(struct mt7601u_dev *dev,
 			    struct cfg80211_chan_def *chandef);
 void mt7601u_phy_recalibrate_after_assoc(struct mt7601u_dev *dev);
@@ -357,15 +1053,38 @@ void mt7601u_mac_config_tsf(struct mt7601u_dev *dev, bool enable, int interval);
 void
 mt7601u_mac_wcid_setup(struct mt7601u_dev *dev, u8 idx, u8 vif_idx, u8 *mac);
 void mt7601u_mac_set_ampdu_factor(struct mt7601u_dev *dev);
+void mt7601u_mac_ampdu_refresh(struct mt7601u_dev *dev);
+void mt7601u_mac_ampdu_ctl_init(struct mt7601u_dev *dev, struct mt76_sta *msta,
+				struct ieee80211_sta *sta);
 
 /* TX */
+void mt7601u_wake_tx_queue(struct ieee80211_hw *hw, struct ieee80211_txq *txq);
+void mt7601u_tx_tasklet(unsigned long data);
+void mt7601u_txq_init(struct mt7601u_dev *dev, struct ieee80211_txq *txq);
+void mt7601u_txq_remove(struct mt7601u_dev *dev, struct ieee80211_txq *txq);
 void mt7601u_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 		struct sk_buff *skb);
+void mt7601u_tx_skb(struct mt7601u_dev *dev, struct ieee80211_sta *sta,
+		    struct sk_buff *skb);
 int mt7601u_conf_tx(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		    u16 queue, const struct ieee80211_tx_queue_params *params);
 void mt7601u_tx_status(struct mt7601u_dev *dev, struct sk_buff *skb);
+void mt7601u_tx_status_flush(struct mt7601u_dev *dev);
 void mt7601u_tx_stat(struct work_struct *work);
 
+/* Scan */
+void mt7601u_scan_work(struct work_struct *work);
+int mt7601u_hw_scan(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
+		    struct ieee80211_scan_request *hw_req);
+void mt7601u_cancel_hw_scan(struct ieee80211_hw *hw, struct ieee80211_vif *vif);
+
+/* Powersave */
+void mt7601u_ps_init(struct mt7601u_dev *dev);
+void mt7601u_ps_set(struct mt7601u_dev *dev, bool enable);
+int mt7601u_ps_wake(struct mt7601u_dev *dev);
+void mt7601u_ps_rx_beacon(struct mt7601u_dev *dev, u8 *data, u32 len);
+void mt7601u_ps_rx_frame(struct mt7601u_dev *dev, u8 *data);
+
 /* util */
 void mt76_remove_hdr_pad(struct sk_buff *skb);
 int mt76_insert_hdr_pad(struct sk_buff *skb);
@@ -379,8 +1098,35 @@ static inline u32 mt7601u_mac_set_ctrlch(struct mt7601u_dev *dev, bool below)
 
 int mt7601u_dma_init(struct mt7601u_dev *dev);
 void mt7601u_dma_cleanup(struct mt7601u_dev *dev);
+void mt7601u_dma_suspend(struct mt7601u_dev *dev);
+int mt7601u_dma_resume(struct mt7601u_dev *dev);
+void mt7601u_dma_rx_pause(struct mt7601u_dev *dev);
+int mt7601u_dma_rx_resume(struct mt7601u_dev *dev);
+
+void mt7601u_rx_aggr_init(struct mt7601u_dev *dev);
+void mt7601u_rx_aggr_work(struct work_struct *work);
+
+bool mt7601u_dma_tx_empty(struct mt7601u_dev *dev);
+
+/**
+ * struct mt7601u_bench_res - result of a per-packet path benchmark run
+ * @ns:		time spent in the measured driver code, timer overhead
+ *		already subtracted.
+ * @frames:	number of frames processed.
+ * @allocs:	skb/page allocations (and reallocations) done by the driver.
+ */
+struct mt7601u_bench_res {
+	u64 ns;
+	u32 frames;
+	u32 allocs;
+};
 
+int mt7601u_bench_rx(struct mt7601u_dev *dev, u32 frame_len, int aggr,
+		     int iters, struct mt7601u_bench_res *res);
+int mt7601u_bench_tx(struct mt7601u_dev *dev, u32 frame_len, int iters,
+		     struct mt7601u_bench_res *res);
 int mt7601u_dma_enqueue_tx(struct mt7601u_dev *dev, struct sk_buff *skb,
 			   struct mt76_wcid *wcid, int hw_q);
+bool mt7601u_dma_tx_room(struct mt7601u_dev *dev, int hw_q);
 
 #endif
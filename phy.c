@@ -23,8 +23,96 @@
 
 static void mt7601u_agc_reset(struct mt7601u_dev *dev);
 
+/* Note: R47/R49 are TSSI/temperature readbacks, R21/R159 report status of
+ *	 resets and calibrations and version is read to detect BBP readiness.
+ */
+static bool mt7601u_bbp_volatile(u8 offset)
+{
+	switch (offset) {
+	case MT_BBP_REG_VERSION:
+	case 21:
+	case 47:
+	case 49:
+	case 159:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* RF 0/4 bit 7 is self-clearing VCO calibration trigger. */
+static bool mt7601u_rf_volatile(u8 bank, u8 offset)
+{
+	return bank >= MT_RF_SHADOW_BANKS || (bank == 0 && offset == 4);
+}
+
+static void
+mt7601u_bbp_shadow_set(struct mt7601u_dev *dev, u8 offset, u8 val)
+{
+	if (mt7601u_bbp_volatile(offset))
+		return;
+
+	dev->shadow.bbp[offset] = val;
+	__set_bit(offset, dev->shadow.bbp_valid);
+}
+
+static int mt7601u_bbp_shadow_get(struct mt7601u_dev *dev, u8 offset)
+{
+	if (mt7601u_bbp_volatile(offset) ||
+	    !test_bit(offset, dev->shadow.bbp_valid)) {
+		dev->shadow.misses++;
+		return -ENOENT;
+	}
+
+	dev->shadow.hits++;
+	return dev->shadow.bbp[offset];
+}
+
+static void
+mt7601u_rf_shadow_set(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 val)
+{
+	if (mt7601u_rf_volatile(bank, offset))
+		return;
+
+	dev->shadow.rf[bank][offset] = val;
+	__set_bit(bank * MT_RF_SHADOW_REGS + offset, dev->shadow.rf_valid);
+}
+
+static int mt7601u_rf_shadow_get(struct mt7601u_dev *dev, u8 bank, u8 offset)
+{
+	if (mt7601u_rf_volatile(bank, offset) ||
+	    !test_bit(bank * MT_RF_SHADOW_REGS + offset, dev->shadow.rf_valid)) {
+		dev->shadow.misses++;
+		return -ENOENT;
+	}
+
+	dev->shadow.hits++;
+	return dev->shadow.rf[bank][offset];
+}
+
+void mt7601u_phy_shadow_reset(struct mt7601u_dev *dev)
+{
+	mutex_lock(&dev->reg_atomic_mutex);
+	bitmap_zero(dev->shadow.bbp_valid, MT_BBP_SHADOW_REGS);
+	bitmap_zero(dev->shadow.rf_valid,
+		    MT_RF_SHADOW_BANKS * MT_RF_SHADOW_REGS);
+	mutex_unlock(&dev->reg_atomic_mutex);
+}
+
+/* Record write to BBP or RF register done through the MCU register map. */
+void mt7601u_phy_shadow_update(struct mt7601u_dev *dev, u32 addr, u8 val)
+{
+	mutex_lock(&dev->reg_atomic_mutex);
+	if (addr & MT_MCU_MEMMAP_RF)
+		mt7601u_rf_shadow_set(dev, (addr >> 16) & 0xff, addr & 0x3f,
+				      val);
+	else if (addr & MT_MCU_MEMMAP_BBP)
+		mt7601u_bbp_shadow_set(dev, addr & 0xff, val);
+	mutex_unlock(&dev->reg_atomic_mutex);
+}
+
 static int
-mt7601u_rf_wr(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 value)
+__mt7601u_rf_wr(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 value)
 {
 	int ret = 0;
 
@@ -46,6 +134,7 @@ mt7601u_rf_wr(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 value)
 				       MT76_SET(MT_RF_CSR_CFG_REG_ID, offset) |
 				       MT_RF_CSR_CFG_WR |
 				       MT_RF_CSR_CFG_KICK);
+	mt7601u_rf_shadow_set(dev, bank, offset, value);
 	trace_rf_write(dev, bank, offset, value);
 out:
 	mutex_unlock(&dev->reg_atomic_mutex);
@@ -57,8 +146,24 @@ out:
 	return ret;
 }
 
+/* Note: indirect accessors below are noinline so that _RET_IP_ profiling
+ *	 attributes the access to their real caller.
+ */
+static noinline int
+mt7601u_rf_wr(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 value)
+{
+	struct mt7601u_prof_ctx prof;
+	int ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt7601u_rf_wr(dev, bank, offset, value);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_RF, _RET_IP_);
+
+	return ret;
+}
+
 static int
-mt7601u_rf_rr(struct mt7601u_dev *dev, u8 bank, u8 offset)
+__mt7601u_rf_rr(struct mt7601u_dev *dev, u8 bank, u8 offset)
 {
 	int ret = -ETIMEDOUT;
 	u32 val;
@@ -71,6 +176,11 @@ mt7601u_rf_rr(struct mt7601u_dev *dev, u8 bank, u8 offset)
 
 	mutex_lock(&dev->reg_atomic_mutex);
 
+	ret = mt7601u_rf_shadow_get(dev, bank, offset);
+	if (ret >= 0)
+		goto out;
+	ret = -ETIMEDOUT;
+
 	if (!mt76_poll(dev, MT_RF_CSR_CFG, MT_RF_CSR_CFG_KICK, 0, 100))
 		goto out;
 
@@ -85,6 +195,7 @@ mt7601u_rf_rr(struct mt7601u_dev *dev, u8 bank, u8 offset)
 	if (MT76_GET(MT_RF_CSR_CFG_REG_ID, val) == offset &&
 	    MT76_GET(MT_RF_CSR_CFG_REG_BANK, val) == bank) {
 		ret = MT76_GET(MT_RF_CSR_CFG_DATA, val);
+		mt7601u_rf_shadow_set(dev, bank, offset, ret);
 		trace_rf_read(dev, bank, offset, ret);
 	}
 out:
@@ -97,6 +208,19 @@ out:
 	return ret;
 }
 
+static noinline int
+mt7601u_rf_rr(struct mt7601u_dev *dev, u8 bank, u8 offset)
+{
+	struct mt7601u_prof_ctx prof;
+	int ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt7601u_rf_rr(dev, bank, offset);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_RF, _RET_IP_);
+
+	return ret;
+}
+
 static int
 mt7601u_rf_rmw(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 mask, u8 val)
 {
@@ -125,7 +249,7 @@ mt7601u_rf_clear(struct mt7601u_dev *dev, u8 bank, u8 offset, u8 mask)
 	return mt7601u_rf_rmw(dev, bank, offset, mask, 0);
 }
 
-static void mt7601u_bbp_wr(struct mt7601u_dev *dev, u8 offset, u8 val)
+static void __mt7601u_bbp_wr(struct mt7601u_dev *dev, u8 offset, u8 val)
 {
 	if (WARN_ON(!test_bit(MT7601U_STATE_WLAN_RUNNING, &dev->state)) ||
 	    test_bit(MT7601U_STATE_REMOVED, &dev->state))
@@ -142,12 +266,23 @@ static void mt7601u_bbp_wr(struct mt7601u_dev *dev, u8 offset, u8 val)
 		   MT76_SET(MT_BBP_CSR_CFG_VAL, val) |
 		   MT76_SET(MT_BBP_CSR_CFG_REG_NUM, offset) |
 		   MT_BBP_CSR_CFG_RW_MODE | MT_BBP_CSR_CFG_BUSY);
+	mt7601u_bbp_shadow_set(dev, offset, val);
 	trace_bbp_write(dev, offset, val);
 out:
 	mutex_unlock(&dev->reg_atomic_mutex);
 }
 
-static int mt7601u_bbp_rr(struct mt7601u_dev *dev, u8 offset)
+static noinline void
+mt7601u_bbp_wr(struct mt7601u_dev *dev, u8 offset, u8 val)
+{
+	struct mt7601u_prof_ctx prof;
+
+	mt7601u_prof_enter(dev, &prof);
+	__mt7601u_bbp_wr(dev, offset, val);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_BBP, _RET_IP_);
+}
+
+static int __mt7601u_bbp_rr(struct mt7601u_dev *dev, u8 offset)
 {
 	u32 val;
 	int ret = -ETIMEDOUT;
@@ -159,6 +294,11 @@ static int mt7601u_bbp_rr(struct mt7601u_dev *dev, u8 offset)
 
 	mutex_lock(&dev->reg_atomic_mutex);
 
+	ret = mt7601u_bbp_shadow_get(dev, offset);
+	if (ret >= 0)
+		goto out;
+	ret = -ETIMEDOUT;
+
 	if (!mt76_poll(dev, MT_BBP_CSR_CFG, MT_BBP_CSR_CFG_BUSY, 0, 1000))
 		goto out;
 
@@ -173,6 +313,7 @@ static int mt7601u_bbp_rr(struct mt7601u_dev *dev, u8 offset)
 	val = mt7601u_rr(dev, MT_BBP_CSR_CFG);
 	if (MT76_GET(MT_BBP_CSR_CFG_REG_NUM, val) == offset) {
 		ret = MT76_GET(MT_BBP_CSR_CFG_VAL, val);
+		mt7601u_bbp_shadow_set(dev, offset, ret);
 		trace_bbp_read(dev, offset, ret);
 	}
 out:
@@ -185,6 +326,18 @@ out:
 	return ret;
 }
 
+static noinline int mt7601u_bbp_rr(struct mt7601u_dev *dev, u8 offset)
+{
+	struct mt7601u_prof_ctx prof;
+	int ret;
+
+	mt7601u_prof_enter(dev, &prof);
+	ret = __mt7601u_bbp_rr(dev, offset);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_BBP, _RET_IP_);
+
+	return ret;
+}
+
 static int mt7601u_bbp_rmw(struct mt7601u_dev *dev, u8 offset, u8 mask, u8 val)
 {
 	int ret;
@@ -313,6 +466,7 @@ static int mt7601u_bbp_temp(struct mt7601u_dev *dev, int mode, const char *name)
 		return 0;
 
 	dev->temp_mode = mode;
+	dev->chan_cache.valid = false;
 	trace_temp_mode(dev, mode);
 
 	t = bbp_mode_table[dev->temp_mode];
@@ -365,22 +519,17 @@ static int __mt7601u_phy_set_channel(struct mt7601u_dev *dev,
 		{ 0x99,	0x99,	0x09,	0x52 },
 		{ 0x33,	0x33,	0x0b,	0x52 },
 	};
-	struct mt76_reg_pair channel_freq_plan[FREQ_PLAN_REGS] = {
-		{ 17, 0 }, { 18, 0 }, { 19, 0 }, { 20, 0 },
-	};
-	struct mt76_reg_pair bbp_settings[3] = {
-		{ 62, 0x37 - dev->ee->lna_gain },
-		{ 63, 0x37 - dev->ee->lna_gain },
-		{ 64, 0x37 - dev->ee->lna_gain },
-	};
-
 	struct ieee80211_channel *chan = chandef->chan;
 	enum nl80211_channel_type chan_type =
 		cfg80211_get_chandef_type(chandef);
 	struct mt7601u_rate_power *t = &dev->ee->power_rate_table;
+	struct mt7601u_chan_cache *cc = &dev->chan_cache;
+	struct mt7601u_reg_batch b;
 	int chan_idx;
 	bool chan_ext_below;
-	u8 bw;
+	u8 bw, prev_bw = dev->bw;
+	s8 ch14;
+	u32 val;
 	int i, ret;
 
 	bw = MT_BW_20;
@@ -409,33 +558,70 @@ static int __mt7601u_phy_set_channel(struct mt7601u_dev *dev,
 		dev->chan_ext_below = chan_ext_below;
 	}
 
+	if (!cc->valid) {
+		cc->tx_alc_cfg_0 = mt7601u_rr(dev, MT_TX_ALC_CFG_0);
+		cc->tx_pwr_cfg_0 = mt7601u_rr(dev, MT_TX_PWR_CFG_0);
+		cc->lna_set = false;
+		cc->ch14 = -1;
+		cc->cal_bw = -1;
+		cc->valid = true;
+	}
+	/* BBP temperature tables loaded on bw change may touch R4/R178 */
+	if (prev_bw != dev->bw)
+		cc->ch14 = -1;
+
+	mt7601u_batch_init(dev, &b);
+
 	for (i = 0; i < FREQ_PLAN_REGS; i++)
-		channel_freq_plan[i].value = freq_plan[chan_idx][i];
+		mt7601u_batch_rf_wr(&b, 17 + i, freq_plan[chan_idx][i]);
 
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_RF,
-				      channel_freq_plan, FREQ_PLAN_REGS);
-	if (ret)
-		return ret;
+	val = cc->tx_alc_cfg_0 & ~0x3f3f;
+	val |= dev->ee->chan_pwr[chan_idx] & 0x3f;
+	if (val != cc->tx_alc_cfg_0) {
+		mt7601u_batch_wr(&b, MT_TX_ALC_CFG_0, val);
+		cc->tx_alc_cfg_0 = val;
+	}
 
-	mt7601u_rmw(dev, MT_TX_ALC_CFG_0, 0x3f3f,
-		    dev->ee->chan_pwr[chan_idx] & 0x3f);
+	if (!cc->lna_set) {
+		for (i = 62; i <= 64; i++)
+			mt7601u_batch_bbp_wr(&b, i, 0x37 - dev->ee->lna_gain);
+		cc->lna_set = true;
+	}
 
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_BBP,
-				      bbp_settings, ARRAY_SIZE(bbp_settings));
-	if (ret)
+	ret = mt7601u_batch_commit(&b);
+	if (ret) {
+		cc->valid = false;
 		return ret;
+	}
 
 	mt7601u_vco_cal(dev);
 	mt7601u_bbp_set_bw(dev, bw);
-	ret = mt7601u_set_bw_filter(dev, false);
-	if (ret)
-		return ret;
 
-	mt7601u_apply_ch14_fixup(dev, chan->hw_value);
-	mt7601u_wr(dev, MT_TX_PWR_CFG_0, int_to_s6(t->ofdm[1].bw20) << 24 |
-					 int_to_s6(t->ofdm[0].bw20) << 16 |
-					 int_to_s6(t->cck[1].bw20) << 8 |
-					 int_to_s6(t->cck[0].bw20));
+	if (cc->cal_bw != dev->bw ||
+	    abs(dev->raw_temp - cc->cal_temp) > MT_CHAN_CAL_TEMP_DELTA) {
+		ret = mt7601u_set_bw_filter(dev, false);
+		if (ret) {
+			cc->cal_bw = -1;
+			return ret;
+		}
+		cc->cal_bw = dev->bw;
+		cc->cal_temp = dev->raw_temp;
+	}
+
+	ch14 = chan->hw_value == 14 && dev->bw == MT_BW_20;
+	if (ch14 != cc->ch14) {
+		mt7601u_apply_ch14_fixup(dev, chan->hw_value);
+		cc->ch14 = ch14;
+	}
+
+	val = int_to_s6(t->ofdm[1].bw20) << 24 |
+	      int_to_s6(t->ofdm[0].bw20) << 16 |
+	      int_to_s6(t->cck[1].bw20) << 8 |
+	      int_to_s6(t->cck[0].bw20);
+	if (val != cc->tx_pwr_cfg_0) {
+		mt7601u_wr(dev, MT_TX_PWR_CFG_0, val);
+		cc->tx_pwr_cfg_0 = val;
+	}
 
 	if (test_bit(MT7601U_STATE_SCANNING, &dev->state))
 		mt7601u_agc_reset(dev);
@@ -445,6 +631,13 @@ static int __mt7601u_phy_set_channel(struct mt7601u_dev *dev,
 	return 0;
 }
 
+static void mt7601u_phy_cal_reset(struct mt7601u_dev *dev)
+{
+	dev->cal.step = 0;
+	dev->cal.agc_valid = false;
+	dev->cal.comp_valid = false;
+}
+
 int mt7601u_phy_set_channel(struct mt7601u_dev *dev,
 			    struct cfg80211_chan_def *chandef)
 {
@@ -452,6 +645,7 @@ int mt7601u_phy_set_channel(struct mt7601u_dev *dev,
 
 	cancel_delayed_work_sync(&dev->cal_work);
 	cancel_delayed_work_sync(&dev->freq_cal.work);
+	mt7601u_phy_cal_reset(dev);
 
 	mutex_lock(&dev->hw_atomic_mutex);
 	ret = __mt7601u_phy_set_channel(dev, chandef);
@@ -497,6 +691,7 @@ static u8 mt7601u_bbp_r47_get(struct mt7601u_dev *dev, u8 reg, u8 flag)
 
 static s8 mt7601u_read_bootup_temp(struct mt7601u_dev *dev)
 {
+	struct mt7601u_reg_batch b;
 	u8 bbp_val, temp;
 	u32 rf_bp, rf_set;
 	int i;
@@ -504,9 +699,11 @@ static s8 mt7601u_read_bootup_temp(struct mt7601u_dev *dev)
 	rf_set = mt7601u_rr(dev, MT_RF_SETTING_0);
 	rf_bp = mt7601u_rr(dev, MT_RF_BYPASS_0);
 
-	mt7601u_wr(dev, MT_RF_BYPASS_0, 0);
-	mt7601u_wr(dev, MT_RF_SETTING_0, 0x00000010);
-	mt7601u_wr(dev, MT_RF_BYPASS_0, 0x00000010);
+	mt7601u_batch_init(dev, &b);
+	mt7601u_batch_wr(&b, MT_RF_BYPASS_0, 0);
+	mt7601u_batch_wr(&b, MT_RF_SETTING_0, 0x00000010);
+	mt7601u_batch_wr(&b, MT_RF_BYPASS_0, 0x00000010);
+	mt7601u_batch_commit(&b);
 
 	bbp_val = mt7601u_bbp_rmw(dev, 47, 0, 0x10);
 
@@ -525,26 +722,30 @@ static s8 mt7601u_read_bootup_temp(struct mt7601u_dev *dev)
 	bbp_val &= ~0x02;
 	mt7601u_bbp_wr(dev, 21, bbp_val);
 
-	mt7601u_wr(dev, MT_RF_BYPASS_0, 0);
-	mt7601u_wr(dev, MT_RF_SETTING_0, rf_set);
-	mt7601u_wr(dev, MT_RF_BYPASS_0, rf_bp);
+	mt7601u_batch_wr(&b, MT_RF_BYPASS_0, 0);
+	mt7601u_batch_wr(&b, MT_RF_SETTING_0, rf_set);
+	mt7601u_batch_wr(&b, MT_RF_BYPASS_0, rf_bp);
+	mt7601u_batch_commit(&b);
 
 	trace_read_temp(dev, temp);
 	return temp;
 }
 
-static s8 mt7601u_read_temp(struct mt7601u_dev *dev)
+static void mt7601u_read_temp_kick(struct mt7601u_dev *dev)
+{
+	mt7601u_bbp_rmw(dev, 47, 0x7f, 0x10);
+}
+
+/* Note: measurement started by mt7601u_read_temp_kick() rarely completes
+ *	 (even when polled for a long time), temp can change even if it
+ *	 didn't so just read what is there after a while.
+ */
+static s8 mt7601u_read_temp_get(struct mt7601u_dev *dev)
 {
-	int i;
 	u8 val;
 	s8 temp;
 
-	val = mt7601u_bbp_rmw(dev, 47, 0x7f, 0x10);
-
-	/* Note: this rarely succeeds, temp can change even if it fails. */
-	for (i = 100; i && (val & 0x10); i--)
-		val = mt7601u_bbp_rr(dev, 47);
-
+	val = mt7601u_bbp_rr(dev, 47);
 	temp = mt7601u_bbp_r47_get(dev, val, BBP_R47_F_TEMP);
 
 	trace_read_temp(dev, temp);
@@ -559,14 +760,17 @@ static void mt7601u_rxdc_cal(struct mt7601u_dev *dev)
 	}, outro[] = {
 		{ 158, 0x8d }, { 159, 0xe0 },
 	};
+	struct mt7601u_reg_batch b;
 	u32 mac_ctrl;
 	int i, ret;
 
 	mac_ctrl = mt7601u_rr(dev, MT_MAC_SYS_CTRL);
-	mt7601u_wr(dev, MT_MAC_SYS_CTRL, MT_MAC_SYS_CTRL_ENABLE_RX);
 
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_BBP,
-				      intro, ARRAY_SIZE(intro));
+	mt7601u_batch_init(dev, &b);
+	mt7601u_batch_wr(&b, MT_MAC_SYS_CTRL, MT_MAC_SYS_CTRL_ENABLE_RX);
+	for (i = 0; i < ARRAY_SIZE(intro); i++)
+		mt7601u_batch_bbp_wr(&b, intro[i].reg, intro[i].value);
+	ret = mt7601u_batch_commit(&b);
 	if (ret)
 		dev_err(dev->dev, "%s intro failed:%d\n", __func__, ret);
 
@@ -580,14 +784,14 @@ static void mt7601u_rxdc_cal(struct mt7601u_dev *dev)
 	if (!i)
 		dev_err(dev->dev, "%s timed out\n", __func__);
 
-	mt7601u_wr(dev, MT_MAC_SYS_CTRL, 0);
-
-	ret = mt7601u_write_reg_pairs(dev, MT_MCU_MEMMAP_BBP,
-				      outro, ARRAY_SIZE(outro));
+	mt7601u_batch_init(dev, &b);
+	mt7601u_batch_wr(&b, MT_MAC_SYS_CTRL, 0);
+	for (i = 0; i < ARRAY_SIZE(outro); i++)
+		mt7601u_batch_bbp_wr(&b, outro[i].reg, outro[i].value);
+	mt7601u_batch_wr(&b, MT_MAC_SYS_CTRL, mac_ctrl);
+	ret = mt7601u_batch_commit(&b);
 	if (ret)
 		dev_err(dev->dev, "%s outro failed:%d\n", __func__, ret);
-
-	mt7601u_wr(dev, MT_MAC_SYS_CTRL, mac_ctrl);
 }
 
 void mt7601u_phy_recalibrate_after_assoc(struct mt7601u_dev *dev)
@@ -643,18 +847,21 @@ mt7601u_set_initial_tssi(struct mt7601u_dev *dev, s16 tssi_db, s16 tssi_hvga_db)
 
 static void mt7601u_tssi_dc_gain_cal(struct mt7601u_dev *dev)
 {
+	struct mt7601u_reg_batch b;
 	u8 rf_vga, rf_mixer, bbp_r47;
 	int i, j;
 	s8 res[4];
 	s16 tssi_init_db, tssi_init_hvga_db;
 
-	mt7601u_wr(dev, MT_RF_SETTING_0, 0x00000030);
-	mt7601u_wr(dev, MT_RF_BYPASS_0, 0x000c0030);
-	mt7601u_wr(dev, MT_MAC_SYS_CTRL, 0);
+	mt7601u_batch_init(dev, &b);
+	mt7601u_batch_wr(&b, MT_RF_SETTING_0, 0x00000030);
+	mt7601u_batch_wr(&b, MT_RF_BYPASS_0, 0x000c0030);
+	mt7601u_batch_wr(&b, MT_MAC_SYS_CTRL, 0);
 
-	mt7601u_bbp_wr(dev, 58, 0);
-	mt7601u_bbp_wr(dev, 241, 0x2);
-	mt7601u_bbp_wr(dev, 23, 0x8);
+	mt7601u_batch_bbp_wr(&b, 58, 0);
+	mt7601u_batch_bbp_wr(&b, 241, 0x2);
+	mt7601u_batch_bbp_wr(&b, 23, 0x8);
+	mt7601u_batch_commit(&b);
 	bbp_r47 = mt7601u_bbp_rr(dev, 47);
 
 	/* Set VGA gain */
@@ -705,15 +912,18 @@ static void mt7601u_tssi_dc_gain_cal(struct mt7601u_dev *dev)
 		dev->tssi_init, tssi_init_db, dev->tssi_init_hvga,
 		tssi_init_hvga_db, dev->tssi_init_hvga_offset_db);
 
-	mt7601u_bbp_wr(dev, 22, 0);
-	mt7601u_bbp_wr(dev, 244, 0);
+	mt7601u_batch_bbp_wr(&b, 22, 0);
+	mt7601u_batch_bbp_wr(&b, 244, 0);
+	mt7601u_batch_commit(&b);
 
+	/* Soft reset pulse is timed, don't queue it */
 	mt7601u_bbp_wr(dev, 21, 1);
 	udelay(1);
 	mt7601u_bbp_wr(dev, 21, 0);
 
-	mt7601u_wr(dev, MT_RF_BYPASS_0, 0);
-	mt7601u_wr(dev, MT_RF_SETTING_0, 0);
+	mt7601u_batch_wr(&b, MT_RF_BYPASS_0, 0);
+	mt7601u_batch_wr(&b, MT_RF_SETTING_0, 0);
+	mt7601u_batch_commit(&b);
 
 	mt7601u_rf_wr(dev, 5, 3, rf_vga);
 	mt7601u_rf_wr(dev, 4, 39, rf_mixer);
@@ -957,6 +1167,7 @@ static void mt7601u_agc_reset(struct mt7601u_dev *dev)
 	u8 agc = mt7601u_agc_default(dev);
 
 	mt7601u_bbp_wr(dev, 66,	agc);
+	dev->cal.agc_valid = false;
 }
 
 void mt7601u_agc_save(struct mt7601u_dev *dev)
@@ -967,48 +1178,127 @@ void mt7601u_agc_save(struct mt7601u_dev *dev)
 void mt7601u_agc_restore(struct mt7601u_dev *dev)
 {
 	mt7601u_bbp_wr(dev, 66, dev->agc_save);
+	dev->cal.agc_valid = false;
+}
+
+/* TX DAC, RX path/control channel, bandwidth, AGC and the CH14 OBW fixup */
+static const u8 mt7601u_pm_bbp_regs[] = { 1, 3, 4, 66, 178 };
+
+void mt7601u_phy_pm_save(struct mt7601u_dev *dev)
+{
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(mt7601u_pm_bbp_regs) != MT_PM_BBP_REGS);
+
+	for (i = 0; i < ARRAY_SIZE(mt7601u_pm_bbp_regs); i++)
+		dev->pm.bbp[i] = mt7601u_bbp_rr(dev, mt7601u_pm_bbp_regs[i]);
+}
+
+void mt7601u_phy_pm_restore(struct mt7601u_dev *dev,
+			    struct mt7601u_reg_batch *b)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mt7601u_pm_bbp_regs); i++)
+		mt7601u_batch_bbp_wr(b, mt7601u_pm_bbp_regs[i],
+				     dev->pm.bbp[i]);
+	dev->cal.agc_valid = false;
 }
 
-static void mt7601u_agc_tune(struct mt7601u_dev *dev)
+static bool mt7601u_agc_tune(struct mt7601u_dev *dev)
 {
-	u8 val = mt7601u_agc_default(dev);
+	u8 bucket = 0;
+	int avg_rssi;
 
 	if (test_bit(MT7601U_STATE_SCANNING, &dev->state))
-		return;
+		return false;
 
 	/* Note: only in STA mode and not dozing; perhaps do this only if
 	 *	 there is enough rssi updates since last run?
 	 *	 Rssi updates are only on beacons and U2M so should work...
 	 */
-	spin_lock_bh(&dev->con_mon_lock);
-	if (dev->avg_rssi <= -70)
-		val -= 0x20;
-	else if (dev->avg_rssi <= -60)
-		val -= 0x10;
-	spin_unlock_bh(&dev->con_mon_lock);
+	avg_rssi = atomic_read(&dev->avg_rssi);
+	if (avg_rssi <= -70)
+		bucket = 2;
+	else if (avg_rssi <= -60)
+		bucket = 1;
 
-	if (val != mt7601u_bbp_rr(dev, 66))
-		mt7601u_bbp_wr(dev, 66, val);
+	if (dev->cal.agc_valid && dev->cal.agc_bucket == bucket)
+		return false;
+
+	mt7601u_bbp_wr(dev, 66, mt7601u_agc_default(dev) - bucket * 0x10);
+	dev->cal.agc_valid = true;
+	dev->cal.agc_bucket = bucket;
 
 	/* TODO: also if lost a lot of beacons try resetting
 	 *       (see RTMPSetAGCInitValue() call in mlme.c).
 	 */
+	return true;
+}
+
+static bool mt7601u_phy_cal_temp_comp(struct mt7601u_dev *dev)
+{
+	struct mt7601u_cal_state *cal = &dev->cal;
+
+	if (cal->comp_valid && cal->comp_temp == dev->raw_temp)
+		return false;
+
+	/* TODO: find right value for @on */
+	cal->comp_valid = !mt7601u_temp_comp(dev, true);
+	cal->comp_temp = dev->raw_temp;
+
+	return true;
+}
+
+/* Run one calibration step, returns false if step had nothing to do. */
+static bool mt7601u_phy_cal_step(struct mt7601u_dev *dev, u8 step)
+{
+	switch (step) {
+	case MT_CAL_STEP_AGC:
+		return mt7601u_agc_tune(dev);
+	case MT_CAL_STEP_TSSI:
+		if (!dev->ee->tssi_enabled)
+			return false;
+		mt7601u_tssi_cal(dev);
+		return true;
+	/* If TSSI calibration is run it already updates temperature. */
+	case MT_CAL_STEP_TEMP_KICK:
+		if (dev->ee->tssi_enabled)
+			return false;
+		mt7601u_read_temp_kick(dev);
+		return true;
+	case MT_CAL_STEP_TEMP_READ:
+		if (dev->ee->tssi_enabled)
+			return false;
+		dev->raw_temp = mt7601u_read_temp_get(dev);
+		return true;
+	case MT_CAL_STEP_TEMP_COMP:
+		return mt7601u_phy_cal_temp_comp(dev);
+	}
+
+	return false;
 }
 
 static void mt7601u_phy_calibrate(struct work_struct *work)
 {
 	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
 					    cal_work.work);
+	struct mt7601u_cal_state *cal = &dev->cal;
+	unsigned long delay = MT_CAL_STEP_DELAY;
+	bool ran;
 
-	mt7601u_agc_tune(dev);
-	mt7601u_tssi_cal(dev);
-	/* If TSSI calibration was run it already updated temperature. */
-	if (!dev->ee->tssi_enabled)
-		dev->raw_temp = mt7601u_read_temp(dev);
-	mt7601u_temp_comp(dev, true); /* TODO: find right value for @on */
+	do {
+		ran = mt7601u_phy_cal_step(dev, cal->step);
+		trace_mt_cal_step(dev, cal->step, ran);
 
-	ieee80211_queue_delayed_work(dev->hw, &dev->cal_work,
-				     MT_CALIBRATE_INTERVAL);
+		if (++cal->step == __MT_CAL_STEP_MAX) {
+			cal->step = 0;
+			delay = MT_CALIBRATE_INTERVAL;
+			break;
+		}
+	} while (!ran);
+
+	ieee80211_queue_delayed_work(dev->hw, &dev->cal_work, delay);
 }
 
 static unsigned long
@@ -1076,32 +1366,43 @@ static void mt7601u_phy_freq_cal(struct work_struct *work)
 	s8 last_offset;
 	u8 phy_mode;
 	unsigned long delay;
+	u32 bcn_mon;
 
-	spin_lock_bh(&dev->con_mon_lock);
-	last_offset = dev->bcn_freq_off;
-	phy_mode = dev->bcn_phy_mode;
-	spin_unlock_bh(&dev->con_mon_lock);
+	bcn_mon = atomic_read(&dev->bcn_mon);
+	last_offset = MT76_GET(MT_BCN_MON_FREQ_OFF, bcn_mon);
+	phy_mode = MT76_GET(MT_BCN_MON_PHY_MODE, bcn_mon);
 
 	delay = __mt7601u_phy_freq_cal(dev, last_offset, phy_mode);
 	ieee80211_queue_delayed_work(dev->hw, &dev->freq_cal.work, delay);
 
-	spin_lock_bh(&dev->con_mon_lock);
-	dev->bcn_freq_off = MT_FREQ_OFFSET_INVALID;
-	spin_unlock_bh(&dev->con_mon_lock);
+	atomic_set(&dev->bcn_mon, MT76_SET(MT_BCN_MON_FREQ_OFF,
+					   MT_FREQ_OFFSET_INVALID));
 }
 
 void mt7601u_phy_con_cal_onoff(struct mt7601u_dev *dev,
 			       struct ieee80211_bss_conf *info)
 {
+	struct mt7601u_bssid *bssid, *old;
+
 	if (!info->assoc)
 		cancel_delayed_work_sync(&dev->freq_cal.work);
 
 	/* Start/stop collecting beacon data */
-	spin_lock_bh(&dev->con_mon_lock);
-	ether_addr_copy(dev->ap_bssid, info->bssid);
-	dev->avg_rssi = 0;
-	dev->bcn_freq_off = MT_FREQ_OFFSET_INVALID;
-	spin_unlock_bh(&dev->con_mon_lock);
+	bssid = kmalloc(sizeof(*bssid), GFP_KERNEL);
+	if (bssid)
+		ether_addr_copy(bssid->addr, info->bssid);
+	else
+		dev_err(dev->dev, "Error: can't allocate BSSID for monitoring\n");
+
+	old = rcu_dereference_protected(dev->ap_bssid,
+					lockdep_is_held(&dev->mutex));
+	rcu_assign_pointer(dev->ap_bssid, bssid);
+	if (old)
+		kfree_rcu(old, rcu_head);
+
+	atomic_set(&dev->avg_rssi, 0);
+	atomic_set(&dev->bcn_mon, MT76_SET(MT_BCN_MON_FREQ_OFF,
+					   MT_FREQ_OFFSET_INVALID));
 
 	dev->freq_cal.freq = dev->ee->rf_freq_off;
 	dev->freq_cal.enabled = info->assoc;
@@ -1218,23 +1519,23 @@ void mt7601u_set_tx_dac(struct mt7601u_dev *dev, u8 dac)
 
 int mt7601u_phy_init(struct mt7601u_dev *dev)
 {
+	static const struct mt7601u_reg_prog rf_prog[] = {
+		MT_REG_PROG(0, rf_central),
+		MT_REG_PROG(0, rf_channel),
+		MT_REG_PROG(0, rf_vga),
+	};
 	int ret;
 
+	dev->chan_cache.valid = false;
+	mt7601u_phy_cal_reset(dev);
+
 	dev->rf_pa_mode[0] = mt7601u_rr(dev, MT_RF_PA_MODE_CFG0);
 	dev->rf_pa_mode[1] = mt7601u_rr(dev, MT_RF_PA_MODE_CFG1);
 
 	ret = mt7601u_rf_wr(dev, 0, 12, dev->ee->rf_freq_off);
 	if (ret)
 		return ret;
-	ret = mt7601u_write_reg_pairs(dev, 0, rf_central,
-				      ARRAY_SIZE(rf_central));
-	if (ret)
-		return ret;
-	ret = mt7601u_write_reg_pairs(dev, 0, rf_channel,
-				      ARRAY_SIZE(rf_channel));
-	if (ret)
-		return ret;
-	ret = mt7601u_write_reg_pairs(dev, 0, rf_vga, ARRAY_SIZE(rf_vga));
+	ret = mt7601u_write_reg_prog(dev, rf_prog, ARRAY_SIZE(rf_prog));
 	if (ret)
 		return ret;
 
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2015 Jakub Kicinski <kubakici@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/etherdevice.h>
+#include "mt7601u.h"
+#include "trace.h"
+
+/* Note: mac80211 drives powersave (IEEE80211_CONF_PS, dynamic PS timeout,
+ *	 null frames), the driver only decides when to doze.  Each beacon
+ *	 from our AP tells how many beacons are left until the next DTIM;
+ *	 the device dozes until MT_PS_WAKE_GUARD_US before that TBTT, timed
+ *	 off the TBTT timer which is synced to the AP's TSF.  Dozing stops
+ *	 MAC RX, kills the RX URBs and pauses MAC and calibration works.
+ *	 The RF is not powered down so frames can still be sent while dozing.
+ *	 If the TIM shows buffered traffic for us (or group traffic after
+ *	 a DTIM) the device stays up until the last buffered frame (the one
+ *	 with MoreData clear) was received or mac80211 leaves PS.  Beacons
+ *	 keep coming while waiting, a TIM without our traffic ends the wait
+ *	 if some frames got lost.
+ */
+
+static bool powersave;
+module_param(powersave, bool, S_IRUGO);
+MODULE_PARM_DESC(powersave,
+		 "advertise powersave support, doze between DTIM beacons when enabled");
+
+static void mt7601u_ps_work_pause(struct delayed_work *w, unsigned long *due)
+{
+	unsigned long expires = READ_ONCE(w->timer.expires);
+
+	*due = cancel_delayed_work_sync(w) ? expires : jiffies;
+}
+
+static void mt7601u_ps_work_resume(struct mt7601u_dev *dev,
+				   struct delayed_work *w, unsigned long due)
+{
+	long left = (long)(due - jiffies);
+
+	ieee80211_queue_delayed_work(dev->hw, w, max(left, 0L));
+}
+
+/* Returns time until MT_PS_WAKE_GUARD_US before the @beacons-th TBTT */
+static s64 mt7601u_ps_sleep_us(struct mt7601u_dev *dev, int beacons)
+{
+	s64 bi_us = dev->ps.beacon_int * 1024;
+	s64 tbtt;
+
+	tbtt = MT76_GET(MT_TBTT_TIMER_CFG_VAL,
+			mt7601u_rr(dev, MT_TBTT_TIMER_CFG)) * 64;
+	/* TSF not synced yet, assume beacon was just received */
+	if (!tbtt || tbtt > bi_us)
+		tbtt = bi_us;
+
+	return tbtt + (beacons - 1) * bi_us - MT_PS_WAKE_GUARD_US;
+}
+
+static void mt7601u_ps_doze(struct mt7601u_dev *dev, int beacons)
+{
+	struct mt7601u_ps *ps = &dev->ps;
+	ktime_t now = ktime_get();
+	s64 sleep_us;
+
+	sleep_us = mt7601u_ps_sleep_us(dev, beacons);
+	if (sleep_us < MT_PS_MIN_SLEEP_US) {
+		/* Not worth it, stay up for the next beacon */
+		ps->deadline = jiffies + MT_PS_BCN_TIMEOUT +
+			usecs_to_jiffies(max_t(s64, sleep_us, 0) +
+					 MT_PS_WAKE_GUARD_US);
+		mod_delayed_work(dev->stat_wq, &ps->work,
+				 ps->deadline - jiffies);
+		return;
+	}
+
+	mt76_clear(dev, MT_MAC_SYS_CTRL, MT_MAC_SYS_CTRL_ENABLE_RX);
+	mt7601u_dma_rx_pause(dev);
+
+	mt7601u_ps_work_pause(&dev->mac_work, &ps->mac_due);
+	mt7601u_ps_work_pause(&dev->cal_work, &ps->cal_due);
+	mt7601u_ps_work_pause(&dev->freq_cal.work, &ps->freq_cal_due);
+
+	ps->dozing = true;
+	hrtimer_start(&ps->timer, ktime_add_us(now, sleep_us),
+		      HRTIMER_MODE_ABS);
+
+	trace_mt_ps_doze(dev, beacons, sleep_us);
+}
+
+int mt7601u_ps_wake(struct mt7601u_dev *dev)
+{
+	struct mt7601u_ps *ps = &dev->ps;
+	int ret;
+
+	if (!ps->dozing)
+		return 0;
+
+	hrtimer_cancel(&ps->timer);
+	atomic_set(&ps->bcn, 0);
+	WRITE_ONCE(ps->retrieve, 0);
+
+	ret = mt7601u_dma_rx_resume(dev);
+	mt76_set(dev, MT_MAC_SYS_CTRL, MT_MAC_SYS_CTRL_ENABLE_RX);
+
+	mt7601u_ps_work_resume(dev, &dev->mac_work, ps->mac_due);
+	mt7601u_ps_work_resume(dev, &dev->cal_work, ps->cal_due);
+	if (dev->freq_cal.enabled)
+		mt7601u_ps_work_resume(dev, &dev->freq_cal.work,
+				       ps->freq_cal_due);
+
+	ps->dozing = false;
+	if (ps->enabled) {
+		ps->deadline = jiffies + MT_PS_BCN_TIMEOUT;
+		mod_delayed_work(dev->stat_wq, &ps->work, MT_PS_BCN_TIMEOUT);
+	}
+
+	trace_mt_ps_wake(dev, ret);
+
+	return ret;
+}
+
+static void mt7601u_ps_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       ps.work.work);
+	struct mt7601u_ps *ps = &dev->ps;
+	int beacons = 1;
+	u32 bcn;
+
+	mutex_lock(&dev->mutex);
+
+	if (!ps->enabled || ps->dozing || !ps->beacon_int)
+		goto out;
+
+	/* Retrieving buffered frames, RX path will kick us when done */
+	if (READ_ONCE(ps->retrieve))
+		goto out;
+
+	if (test_bit(MT7601U_STATE_SCANNING, &dev->state)) {
+		ps->deadline = jiffies + TU_TO_JIFFIES(ps->beacon_int);
+		mod_delayed_work(dev->stat_wq, &ps->work,
+				 TU_TO_JIFFIES(ps->beacon_int));
+		goto out;
+	}
+
+	bcn = atomic_xchg(&ps->bcn, 0);
+	if (bcn & MT_PS_BCN_VALID) {
+		beacons = MT76_GET(MT_PS_BCN_DTIM_COUNT, bcn) ?:
+			  MT76_GET(MT_PS_BCN_DTIM_PERIOD, bcn);
+		beacons = clamp_t(int, beacons, 1,
+				  max_t(int, dev->hw->conf.listen_interval, 1));
+	} else if (time_before(jiffies, ps->deadline)) {
+		/* Stale run, still waiting for a beacon */
+		mod_delayed_work(dev->stat_wq, &ps->work,
+				 ps->deadline - jiffies);
+		goto out;
+	}
+
+	mt7601u_ps_doze(dev, beacons);
+out:
+	mutex_unlock(&dev->mutex);
+}
+
+static void mt7601u_ps_wake_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       ps.wake_work);
+
+	mutex_lock(&dev->mutex);
+	mt7601u_ps_wake(dev);
+	mutex_unlock(&dev->mutex);
+}
+
+static enum hrtimer_restart mt7601u_ps_timer(struct hrtimer *timer)
+{
+	struct mt7601u_dev *dev = container_of(timer, struct mt7601u_dev,
+					       ps.timer);
+
+	queue_work(dev->stat_wq, &dev->ps.wake_work);
+
+	return HRTIMER_NORESTART;
+}
+
+void mt7601u_ps_set(struct mt7601u_dev *dev, bool enable)
+{
+	struct mt7601u_ps *ps = &dev->ps;
+
+	WRITE_ONCE(ps->enabled, enable);
+
+	if (!enable) {
+		cancel_delayed_work(&ps->work);
+		mt7601u_ps_wake(dev);
+		return;
+	}
+
+	/* Stay up until a beacon tells us where the DTIM is */
+	atomic_set(&ps->bcn, 0);
+	WRITE_ONCE(ps->retrieve, 0);
+	ps->deadline = jiffies + TU_TO_JIFFIES(ps->beacon_int) +
+		MT_PS_BCN_TIMEOUT;
+	mod_delayed_work(dev->stat_wq, &ps->work, ps->deadline - jiffies);
+}
+
+/* Note: called from RX path for every beacon of our AP. */
+void mt7601u_ps_rx_beacon(struct mt7601u_dev *dev, u8 *data, u32 len)
+{
+	struct ieee80211_mgmt *mgmt = (struct ieee80211_mgmt *)data;
+	const u32 ies_off = offsetof(struct ieee80211_mgmt, u.beacon.variable);
+	const struct ieee80211_tim_ie *tim;
+	unsigned long retrieve = 0;
+	const u8 *ie;
+
+	if (!READ_ONCE(dev->ps.enabled) || len <= ies_off)
+		return;
+
+	ie = cfg80211_find_ie(WLAN_EID_TIM, mgmt->u.beacon.variable,
+			      len - ies_off);
+	if (!ie || ie[1] < sizeof(*tim))
+		return;
+	tim = (const struct ieee80211_tim_ie *)(ie + 2);
+
+	if (!tim->dtim_count && tim->bitmap_ctrl & 0x01)
+		retrieve |= BIT(MT_PS_RETRIEVE_MC);
+	if (ieee80211_check_tim(tim, ie[1], READ_ONCE(dev->ps.aid)))
+		retrieve |= BIT(MT_PS_RETRIEVE_UC);
+
+	atomic_set(&dev->ps.bcn,
+		   MT76_SET(MT_PS_BCN_DTIM_COUNT, tim->dtim_count) |
+		   MT76_SET(MT_PS_BCN_DTIM_PERIOD, tim->dtim_period) |
+		   MT_PS_BCN_VALID);
+	WRITE_ONCE(dev->ps.retrieve, retrieve);
+
+	if (!retrieve)
+		mod_delayed_work(dev->stat_wq, &dev->ps.work, MT_PS_BCN_GRACE);
+}
+
+/* Note: called from RX path for all other frames, last buffered frame of
+ *	 each kind (MoreData clear) ends the retrieval.
+ */
+void mt7601u_ps_rx_frame(struct mt7601u_dev *dev, u8 *data)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)data;
+	struct mt7601u_ps *ps = &dev->ps;
+	__le16 fc = hdr->frame_control;
+	int bit;
+
+	if (!READ_ONCE(ps->retrieve))
+		return;
+	if (!ieee80211_is_data(fc) || !ieee80211_has_fromds(fc) ||
+	    ieee80211_has_moredata(fc))
+		return;
+
+	bit = is_multicast_ether_addr(hdr->addr1) ? MT_PS_RETRIEVE_MC :
+						  MT_PS_RETRIEVE_UC;
+	if (test_and_clear_bit(bit, &ps->retrieve) && !READ_ONCE(ps->retrieve))
+		mod_delayed_work(dev->stat_wq, &ps->work, MT_PS_BCN_GRACE);
+}
+
+void mt7601u_ps_init(struct mt7601u_dev *dev)
+{
+	struct mt7601u_ps *ps = &dev->ps;
+
+	INIT_DELAYED_WORK(&ps->work, mt7601u_ps_work);
+	INIT_WORK(&ps->wake_work, mt7601u_ps_wake_work);
+	hrtimer_init(&ps->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ps->timer.function = mt7601u_ps_timer;
+	atomic_set(&ps->bcn, 0);
+
+	if (powersave)
+		dev->hw->flags |= IEEE80211_HW_SUPPORTS_PS;
+}
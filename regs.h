@@ -316,6 +316,7 @@
 
 #define MT_TBTT_SYNC_CFG		0x1118
 #define MT_TBTT_TIMER_CFG		0x1124
+#define MT_TBTT_TIMER_CFG_VAL		GENMASK(16, 0)
 
 #define MT_INT_TIMER_CFG		0x1128
 #define MT_INT_TIMER_CFG_PRE_TBTT	GENMASK(15, 0)
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2015 Jakub Kicinski <kubakici@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "mt7601u.h"
+#include "trace.h"
+
+/* Note: scan is driven by a delayed work which does one step per run -
+ *	 it either hops to the next channel (sending probe requests if the
+ *	 channel allows it) or, when associated, goes back to the operating
+ *	 channel for MT_SCAN_OPER_DWELL after every MT_SCAN_CHANS_PER_VISIT
+ *	 scanned channels so that traffic is not stalled for the whole scan.
+ *	 Channel switches benefit from the channel cache in phy.c, revisits
+ *	 of the operating channel are mostly a single batched write.
+ */
+
+static bool mt7601u_scan_assoc(struct mt7601u_scan *scan)
+{
+	return scan->vif->type == NL80211_IFTYPE_STATION &&
+	       scan->vif->bss_conf.assoc;
+}
+
+/* Frames built by the driver go through mac80211 TX handlers so that they
+ * get sequence numbers and rates picked by rate control honouring flags like
+ * IEEE80211_TX_CTL_NO_CCK_RATE.
+ */
+static void mt7601u_scan_tx(struct mt7601u_dev *dev, struct sk_buff *skb,
+			    enum ieee80211_band band)
+{
+	struct ieee80211_sta *sta;
+
+	skb_set_queue_mapping(skb, IEEE80211_AC_VO);
+
+	local_bh_disable();
+	rcu_read_lock();
+	if (ieee80211_tx_prepare_skb(dev->hw, dev->scan.vif, skb, band, &sta))
+		mt7601u_tx_skb(dev, sta, skb);
+	else
+		ieee80211_free_txskb(dev->hw, skb);
+	rcu_read_unlock();
+	local_bh_enable();
+}
+
+/* Tell the AP we are going to sleep before leaving the operating channel,
+ * the same thing mac80211 does for software scans.
+ */
+static void mt7601u_scan_ps(struct mt7601u_dev *dev, bool enable)
+{
+	struct mt7601u_scan *scan = &dev->scan;
+	struct ieee80211_hdr *hdr;
+	struct sk_buff *skb;
+
+	if (!mt7601u_scan_assoc(scan))
+		return;
+
+	skb = ieee80211_nullfunc_get(dev->hw, scan->vif);
+	if (!skb)
+		return;
+
+	hdr = (struct ieee80211_hdr *)skb->data;
+	if (enable)
+		hdr->frame_control |= cpu_to_le16(IEEE80211_FCTL_PM);
+
+	mt7601u_scan_tx(dev, skb, scan->oper.chan->band);
+}
+
+static void mt7601u_scan_probe(struct mt7601u_dev *dev,
+			       struct ieee80211_channel *chan)
+{
+	struct mt7601u_scan *scan = &dev->scan;
+	struct cfg80211_scan_request *req = scan->req;
+	struct ieee80211_scan_ies *ies = scan->ies;
+	enum ieee80211_band band = chan->band;
+	struct sk_buff *skb;
+	int i;
+
+	for (i = 0; i < req->n_ssids; i++) {
+		skb = ieee80211_probereq_get(dev->hw, scan->vif->addr,
+					     req->ssids[i].ssid,
+					     req->ssids[i].ssid_len,
+					     ies->len[band] +
+					     ies->common_ie_len);
+		if (!skb)
+			continue;
+
+		if (ies->len[band])
+			memcpy(skb_put(skb, ies->len[band]), ies->ies[band],
+			       ies->len[band]);
+		if (ies->common_ie_len)
+			memcpy(skb_put(skb, ies->common_ie_len),
+			       ies->common_ies, ies->common_ie_len);
+
+		IEEE80211_SKB_CB(skb)->flags |= IEEE80211_TX_CTL_NO_ACK;
+		if (req->no_cck)
+			IEEE80211_SKB_CB(skb)->flags |=
+				IEEE80211_TX_CTL_NO_CCK_RATE;
+
+		mt7601u_scan_tx(dev, skb, band);
+	}
+}
+
+/* Give frames queued for the current channel a moment to go out. */
+static void mt7601u_scan_tx_drain(struct mt7601u_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < MT_SCAN_DRAIN_MS && !mt7601u_dma_tx_empty(dev); i++)
+		usleep_range(1000, 1500);
+}
+
+static int mt7601u_scan_set_channel(struct mt7601u_dev *dev,
+				    struct ieee80211_channel *chan)
+{
+	struct cfg80211_chan_def chandef;
+
+	cfg80211_chandef_create(&chandef, chan, NL80211_CHAN_NO_HT);
+	trace_scan_chan(dev, chan->hw_value);
+
+	return mt7601u_phy_set_channel(dev, &chandef);
+}
+
+static void mt7601u_scan_leave_oper(struct mt7601u_dev *dev)
+{
+	struct mt7601u_scan *scan = &dev->scan;
+
+	/* Set the bit first so TX completions don't wake the queues */
+	set_bit(MT7601U_STATE_OFFCHANNEL, &dev->state);
+	ieee80211_stop_queues(dev->hw);
+	mt7601u_scan_ps(dev, true);
+	mt7601u_scan_tx_drain(dev);
+
+	scan->on_oper = false;
+}
+
+static int mt7601u_scan_return_oper(struct mt7601u_dev *dev)
+{
+	struct mt7601u_scan *scan = &dev->scan;
+	int ret;
+
+	mt7601u_scan_tx_drain(dev);
+
+	trace_scan_chan(dev, scan->oper.chan->hw_value);
+	ret = mt7601u_phy_set_channel(dev, &scan->oper);
+	mt7601u_agc_restore(dev);
+
+	clear_bit(MT7601U_STATE_OFFCHANNEL, &dev->state);
+	mt7601u_scan_ps(dev, false);
+	ieee80211_wake_queues(dev->hw);
+	mt7601u_tx_kick(dev);
+
+	scan->on_oper = true;
+	scan->since_oper = 0;
+
+	return ret;
+}
+
+static void mt7601u_scan_finish(struct mt7601u_dev *dev, bool aborted)
+{
+	struct mt7601u_scan *scan = &dev->scan;
+
+	clear_bit(MT7601U_STATE_SCANNING, &dev->state);
+	if (!scan->on_oper)
+		mt7601u_scan_return_oper(dev);
+	else /* kick calibration back in */
+		mt7601u_phy_set_channel(dev, &scan->oper);
+	mt7601u_agc_restore(dev);
+
+	scan->req = NULL;
+	scan->vif = NULL;
+
+	ieee80211_scan_completed(dev->hw, aborted);
+}
+
+void mt7601u_scan_work(struct work_struct *work)
+{
+	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
+					       scan.work.work);
+	struct mt7601u_scan *scan = &dev->scan;
+	struct ieee80211_channel *chan;
+	unsigned long dwell;
+	int ret;
+
+	mutex_lock(&dev->mutex);
+
+	if (!scan->req)
+		goto out;
+
+	if (READ_ONCE(scan->abort) || scan->chan_idx >= scan->req->n_channels) {
+		mt7601u_scan_finish(dev, READ_ONCE(scan->abort));
+		goto out;
+	}
+
+	if (!scan->on_oper && mt7601u_scan_assoc(scan) &&
+	    scan->since_oper >= MT_SCAN_CHANS_PER_VISIT) {
+		mt7601u_scan_return_oper(dev);
+		ieee80211_queue_delayed_work(dev->hw, &scan->work,
+					     MT_SCAN_OPER_DWELL);
+		goto out;
+	}
+
+	if (scan->on_oper)
+		mt7601u_scan_leave_oper(dev);
+
+	chan = scan->req->channels[scan->chan_idx++];
+	scan->since_oper++;
+
+	ret = mt7601u_scan_set_channel(dev, chan);
+	if (ret) {
+		dev_err(dev->dev, "Error: scan channel switch failed:%d\n",
+			ret);
+		mt7601u_scan_finish(dev, true);
+		goto out;
+	}
+
+	if (chan->flags & IEEE80211_CHAN_NO_IR || !scan->req->n_ssids) {
+		dwell = MT_SCAN_PASSIVE_DWELL;
+	} else {
+		mt7601u_scan_probe(dev, chan);
+		dwell = MT_SCAN_ACTIVE_DWELL;
+	}
+
+	ieee80211_queue_delayed_work(dev->hw, &scan->work, dwell);
+out:
+	mutex_unlock(&dev->mutex);
+}
+
+int mt7601u_hw_scan(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
+		    struct ieee80211_scan_request *hw_req)
+{
+	struct mt7601u_dev *dev = hw->priv;
+	struct mt7601u_scan *scan = &dev->scan;
+
+	mutex_lock(&dev->mutex);
+
+	if (scan->req) {
+		mutex_unlock(&dev->mutex);
+		return -EBUSY;
+	}
+
+	scan->vif = vif;
+	scan->req = &hw_req->req;
+	scan->ies = &hw_req->ies;
+	scan->oper = dev->chandef;
+	scan->chan_idx = 0;
+	scan->since_oper = 0;
+	scan->on_oper = true;
+	WRITE_ONCE(scan->abort, false);
+
+	mt7601u_ps_wake(dev);
+	mt7601u_agc_save(dev);
+	set_bit(MT7601U_STATE_SCANNING, &dev->state);
+
+	ieee80211_queue_delayed_work(hw, &scan->work, 0);
+
+	mutex_unlock(&dev->mutex);
+
+	return 0;
+}
+
+void mt7601u_cancel_hw_scan(struct ieee80211_hw *hw, struct ieee80211_vif *vif)
+{
+	struct mt7601u_dev *dev = hw->priv;
+
+	WRITE_ONCE(dev->scan.abort, true);
+	cancel_delayed_work(&dev->scan.work);
+	ieee80211_queue_delayed_work(hw, &dev->scan.work, 0);
+}
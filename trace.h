@@ -251,6 +251,91 @@ TRACE_EVENT(freq_cal_offset,
 		  DEV_PR_ARG, __entry->phy_mode, __entry->freq_off)
 );
 
+TRACE_EVENT(mt_cal_step,
+	TP_PROTO(struct mt7601u_dev *dev, u8 step, bool ran),
+	TP_ARGS(dev, step, ran),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(u8, step)
+		__field(bool, ran)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->step = step;
+		__entry->ran = ran;
+	),
+	TP_printk(DEV_PR_FMT "step:%hhu ran:%d",
+		  DEV_PR_ARG, __entry->step, __entry->ran)
+);
+
+TRACE_EVENT(mt_ampdu_ctl,
+	TP_PROTO(struct mt7601u_dev *dev, u8 wcid, u8 bad_pct, u8 ba_size,
+		 u8 density),
+	TP_ARGS(dev, wcid, bad_pct, ba_size, density),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(u8, wcid)
+		__field(u8, bad_pct)
+		__field(u8, ba_size)
+		__field(u8, density)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->wcid = wcid;
+		__entry->bad_pct = bad_pct;
+		__entry->ba_size = ba_size;
+		__entry->density = density;
+	),
+	TP_printk(DEV_PR_FMT "wcid:%hhu bad:%hhu%% ba:%hhu density:%hhu",
+		  DEV_PR_ARG, __entry->wcid, __entry->bad_pct,
+		  __entry->ba_size, __entry->density)
+);
+
+TRACE_EVENT(mt_fw_chunk,
+	TP_PROTO(struct mt7601u_dev *dev, u32 dst, u32 len,
+		 s64 setup_us, s64 xfer_us, s64 poll_us),
+	TP_ARGS(dev, dst, len, setup_us, xfer_us, poll_us),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(u32, dst)
+		__field(u32, len)
+		__field(s64, setup_us)
+		__field(s64, xfer_us)
+		__field(s64, poll_us)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->dst = dst;
+		__entry->len = len;
+		__entry->setup_us = setup_us;
+		__entry->xfer_us = xfer_us;
+		__entry->poll_us = poll_us;
+	),
+	TP_printk(DEV_PR_FMT "dst:%08x len:%u setup:%lldus xfer:%lldus poll:%lldus",
+		  DEV_PR_ARG, __entry->dst, __entry->len, __entry->setup_us,
+		  __entry->xfer_us, __entry->poll_us)
+);
+
+TRACE_EVENT(mt_fw_upload,
+	TP_PROTO(struct mt7601u_dev *dev, u32 bytes, int chunks, s64 total_us),
+	TP_ARGS(dev, bytes, chunks, total_us),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(u32, bytes)
+		__field(int, chunks)
+		__field(s64, total_us)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->bytes = bytes;
+		__entry->chunks = chunks;
+		__entry->total_us = total_us;
+	),
+	TP_printk(DEV_PR_FMT "bytes:%u chunks:%d total:%lldus",
+		  DEV_PR_ARG, __entry->bytes, __entry->chunks,
+		  __entry->total_us)
+);
+
 TRACE_EVENT(mt_rx,
 	TP_PROTO(struct mt7601u_dev *dev, struct mt7601u_rxwi *rxwi, u32 f),
 	TP_ARGS(dev, rxwi, f),
@@ -351,17 +436,73 @@ TRACE_EVENT(mt_tx_status,
 );
 
 TRACE_EVENT(mt_rx_dma_aggr,
-	TP_PROTO(struct mt7601u_dev *dev, int cnt),
-	TP_ARGS(dev, cnt),
+	TP_PROTO(struct mt7601u_dev *dev, int cnt, bool paged),
+	TP_ARGS(dev, cnt, paged),
 	TP_STRUCT__entry(
 		DEV_ENTRY
 		__field(u8, cnt)
+		__field(bool, paged)
 	),
 	TP_fast_assign(
 		DEV_ASSIGN;
 		__entry->cnt = cnt;
+		__entry->paged = paged;
 	),
-	TP_printk(DEV_PR_FMT "%d", DEV_PR_ARG, __entry->cnt)
+	TP_printk(DEV_PR_FMT "cnt:%d paged:%d",
+		  DEV_PR_ARG, __entry->cnt, __entry->paged)
+);
+
+TRACE_EVENT(mt_rx_poll,
+	TP_PROTO(struct mt7601u_dev *dev, int cnt, bool more),
+	TP_ARGS(dev, cnt, more),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(int, cnt)
+		__field(bool, more)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->cnt = cnt;
+		__entry->more = more;
+	),
+	TP_printk(DEV_PR_FMT "cnt:%d more:%d",
+		  DEV_PR_ARG, __entry->cnt, __entry->more)
+);
+
+TRACE_EVENT(mt_ps_doze,
+	TP_PROTO(struct mt7601u_dev *dev, int beacons, u32 sleep_us),
+	TP_ARGS(dev, beacons, sleep_us),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(int, beacons)
+		__field(u32, sleep_us)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->beacons = beacons;
+		__entry->sleep_us = sleep_us;
+	),
+	TP_printk(DEV_PR_FMT "beacons:%d sleep:%uus",
+		  DEV_PR_ARG, __entry->beacons, __entry->sleep_us)
+);
+
+TRACE_EVENT(mt_ps_wake,
+	TP_PROTO(struct mt7601u_dev *dev, int ret),
+	TP_ARGS(dev, ret),
+	TP_STRUCT__entry(
+		DEV_ENTRY
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		DEV_ASSIGN;
+		__entry->ret = ret;
+	),
+	TP_printk(DEV_PR_FMT "ret:%d", DEV_PR_ARG, __entry->ret)
+);
+
+DEFINE_EVENT(dev_simple_evt, scan_chan,
+	TP_PROTO(struct mt7601u_dev *dev, u8 val),
+	TP_ARGS(dev, val)
 );
 
 DEFINE_EVENT(dev_simple_evt, set_key,
@@ -14,6 +14,7 @@
 
 #include "mt7601u.h"
 #include "trace.h"
+#include "dma.h"
 
 enum mt76_txq_id {
 	MT_TXQ_VO = IEEE80211_AC_VO,
@@ -95,10 +96,29 @@ mt7601u_tx_pktid_dec(struct mt7601u_dev *dev, struct mt76_tx_status *stat)
 	stat->retry = req_rate - eff_rate;
 }
 
+/* Per-frame driver data kept in the status area of tx_info.  Filled in after
+ * the TXWI is built, when nothing in info->control is needed any more.
+ */
+struct mt7601u_tx_cb {
+	u16 pkt_len;
+	u8 wcid;
+	u8 pktid;
+	unsigned long jiffies;
+};
+
+static struct mt7601u_tx_cb *mt7601u_tx_skb_cb(struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+
+	BUILD_BUG_ON(sizeof(struct mt7601u_tx_cb) >
+		     sizeof(info->status.status_driver_data));
+	return (void *)info->status.status_driver_data;
+}
+
 static void mt7601u_tx_skb_remove_dma_overhead(struct sk_buff *skb,
 					       struct ieee80211_tx_info *info)
 {
-	int pkt_len = (unsigned long)info->status.status_driver_data[0];
+	int pkt_len = mt7601u_tx_skb_cb(skb)->pkt_len;
 
 	skb_pull(skb, sizeof(struct mt76_txwi) + 4);
 	if (ieee80211_get_hdrlen_from_skb(skb) % 4)
@@ -107,18 +127,105 @@ static void mt7601u_tx_skb_remove_dma_overhead(struct sk_buff *skb,
 	skb_trim(skb, pkt_len);
 }
 
-void mt7601u_tx_status(struct mt7601u_dev *dev, struct sk_buff *skb)
+/* Report frame for which real TX status is not known (AMPDUs, frames whose
+ * status got lost or never came).
+ */
+static void
+mt7601u_tx_status_unknown(struct mt7601u_dev *dev, struct sk_buff *skb)
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
 
-	mt7601u_tx_skb_remove_dma_overhead(skb, info);
-
 	ieee80211_tx_info_clear_status(info);
 	info->status.rates[0].idx = -1;
 	info->flags |= IEEE80211_TX_STAT_ACK;
 	ieee80211_tx_status(dev->hw, skb);
 }
 
+/* Note: frames waiting for their status from the TX_STAT_FIFO are kept on
+ *	 @tx_pending in the order of URB completions.  Statuses are matched
+ *	 by wcid and pktid (i.e. encoded rate).  Since statuses of a given
+ *	 wcid come in order, older frames of the same wcid which were skipped
+ *	 must have lost their status.
+ *	 AMPDUs get only one status per aggregate (see the note about retry
+ *	 reporting above) so they can't be matched and are still reported
+ *	 right away, their FIFO statuses go to mac80211 without skb.
+ */
+void mt7601u_tx_status(struct mt7601u_dev *dev, struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
+	struct mt7601u_tx_cb *cb = mt7601u_tx_skb_cb(skb);
+
+	mt7601u_tx_skb_remove_dma_overhead(skb, info);
+
+	if (info->flags & (IEEE80211_TX_CTL_AMPDU | IEEE80211_TX_CTL_NO_ACK) ||
+	    test_bit(MT7601U_STATE_REMOVED, &dev->state)) {
+		mt7601u_tx_status_unknown(dev, skb);
+		return;
+	}
+
+	if (skb_queue_len(&dev->tx_pending) >= MT_TX_PENDING_MAX)
+		mt7601u_tx_status_unknown(dev, __skb_dequeue(&dev->tx_pending));
+
+	cb->jiffies = jiffies;
+	__skb_queue_tail(&dev->tx_pending, skb);
+}
+
+static struct sk_buff *
+mt7601u_tx_status_match(struct mt7601u_dev *dev, struct mt76_tx_status *stat)
+{
+	struct sk_buff *skb, *tmp, *match = NULL;
+
+	skb_queue_walk(&dev->tx_pending, skb) {
+		struct mt7601u_tx_cb *cb = mt7601u_tx_skb_cb(skb);
+
+		if (cb->wcid == stat->wcid && cb->pktid == stat->pktid) {
+			match = skb;
+			break;
+		}
+	}
+	if (!match)
+		return NULL;
+
+	skb_queue_walk_safe(&dev->tx_pending, skb, tmp) {
+		if (skb == match)
+			break;
+		if (mt7601u_tx_skb_cb(skb)->wcid != stat->wcid)
+			continue;
+
+		__skb_unlink(skb, &dev->tx_pending);
+		mt7601u_tx_status_unknown(dev, skb);
+	}
+
+	__skb_unlink(match, &dev->tx_pending);
+	return match;
+}
+
+static void mt7601u_tx_status_timeout(struct mt7601u_dev *dev)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_peek(&dev->tx_pending))) {
+		struct mt7601u_tx_cb *cb = mt7601u_tx_skb_cb(skb);
+
+		if (time_before(jiffies, cb->jiffies + MT_TX_STATUS_TIMEOUT))
+			break;
+
+		__skb_unlink(skb, &dev->tx_pending);
+		mt7601u_tx_status_unknown(dev, skb);
+	}
+}
+
+void mt7601u_tx_status_flush(struct mt7601u_dev *dev)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	while ((skb = __skb_dequeue(&dev->tx_pending)))
+		mt7601u_tx_status_unknown(dev, skb);
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+}
+
 static int mt7601u_skb_rooms(struct mt7601u_dev *dev, struct sk_buff *skb)
 {
 	int hdr_len = ieee80211_get_hdrlen_from_skb(skb);
@@ -138,6 +245,10 @@ static int mt7601u_skb_rooms(struct mt7601u_dev *dev, struct sk_buff *skb)
 	return skb_cow(skb, need_head);
 }
 
+/* Note: the per-wcid part of the TXWI is precomputed by rate table and
+ *	 station updates, read it under seqcount so that TX path doesn't have
+ *	 to take dev->lock for every frame.
+ */
 static struct mt76_txwi *
 mt7601u_push_txwi(struct mt7601u_dev *dev, struct sk_buff *skb,
 		  struct ieee80211_sta *sta, struct mt76_wcid *wcid,
@@ -145,75 +256,70 @@ mt7601u_push_txwi(struct mt7601u_dev *dev, struct sk_buff *skb,
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
 	struct ieee80211_tx_rate *rate = &info->control.rates[0];
+	struct mt76_wcid_tmpl tmpl;
 	struct mt76_txwi *txwi;
-	unsigned long flags;
+	unsigned int seq;
 	bool is_probe;
+	u8 ack_ctl = 0;
+	u16 flags = 0;
 	u32 pkt_id;
 	u16 rate_ctl;
 	u8 nss;
 
-	txwi = (struct mt76_txwi *)skb_push(skb, sizeof(struct mt76_txwi));
-	memset(txwi, 0, sizeof(*txwi));
+	do {
+		seq = read_seqcount_begin(&wcid->tmpl_seq);
+		tmpl = wcid->tmpl;
+	} while (read_seqcount_retry(&wcid->tmpl_seq, seq));
 
-	if (!wcid->tx_rate_set)
+	if (!tmpl.rate_set)
 		ieee80211_get_tx_rates(info->control.vif, sta, skb,
 				       info->control.rates, 1);
 
-	spin_lock_irqsave(&dev->lock, flags);
 	if (rate->idx < 0 || !rate->count)
-		rate_ctl = wcid->tx_rate;
+		rate_ctl = tmpl.rate_ctl;
 	else
 		rate_ctl = mt76_mac_tx_rate_val(dev, rate, &nss);
-	spin_unlock_irqrestore(&dev->lock, flags);
-	txwi->rate_ctl = cpu_to_le16(rate_ctl);
+
+	is_probe = !!(info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE);
 
 	if (!(info->flags & IEEE80211_TX_CTL_NO_ACK))
-		txwi->ack_ctl |= MT_TXWI_ACK_CTL_REQ;
+		ack_ctl |= MT_TXWI_ACK_CTL_REQ;
 	if (info->flags & IEEE80211_TX_CTL_ASSIGN_SEQ)
-		txwi->ack_ctl |= MT_TXWI_ACK_CTL_NSEQ;
-
-	if ((info->flags & IEEE80211_TX_CTL_AMPDU) && sta) {
-		u8 ba_size = IEEE80211_MIN_AMPDU_BUF;
-
-		ba_size <<= sta->ht_cap.ampdu_factor;
-		ba_size = min_t(int, 63, ba_size);
-		if (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE)
-			ba_size = 0;
-		txwi->ack_ctl |= MT76_SET(MT_TXWI_ACK_CTL_BA_WINDOW, ba_size);
-
-		txwi->flags = cpu_to_le16(MT_TXWI_FLAGS_AMPDU |
-					  MT76_SET(MT_TXWI_FLAGS_MPDU_DENSITY,
-						   sta->ht_cap.ampdu_density));
-		if (info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE)
-			txwi->flags = 0;
-	}
+		ack_ctl |= MT_TXWI_ACK_CTL_NSEQ;
 
-	txwi->wcid = wcid->idx;
+	if ((info->flags & IEEE80211_TX_CTL_AMPDU) && sta && !is_probe) {
+		ack_ctl |= MT76_SET(MT_TXWI_ACK_CTL_BA_WINDOW, tmpl.ba_size);
+		flags = MT_TXWI_FLAGS_AMPDU |
+			MT76_SET(MT_TXWI_FLAGS_MPDU_DENSITY, tmpl.density);
+	}
 
-	is_probe = !!(info->flags & IEEE80211_TX_CTL_RATE_CTRL_PROBE);
 	pkt_id = mt7601u_tx_pktid_enc(dev, rate_ctl & 0x7, is_probe);
 	pkt_len |= MT76_SET(MT_TXWI_LEN_PKTID, pkt_id);
-	txwi->len_ctl = cpu_to_le16(pkt_len);
+
+	txwi = (struct mt76_txwi *)skb_push(skb, sizeof(struct mt76_txwi));
+	*txwi = (struct mt76_txwi) {
+		.flags = cpu_to_le16(flags),
+		.rate_ctl = cpu_to_le16(rate_ctl),
+		.ack_ctl = ack_ctl,
+		.wcid = wcid->idx,
+		.len_ctl = cpu_to_le16(pkt_len),
+	};
 
 	return txwi;
 }
 
-void mt7601u_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
-		struct sk_buff *skb)
+void mt7601u_tx_skb(struct mt7601u_dev *dev, struct ieee80211_sta *sta,
+		    struct sk_buff *skb)
 {
 	struct ieee80211_tx_info *info = IEEE80211_SKB_CB(skb);
-	struct mt7601u_dev *dev = hw->priv;
 	struct ieee80211_vif *vif = info->control.vif;
-	struct ieee80211_sta *sta = control->sta;
 	struct mt76_sta *msta = NULL;
 	struct mt76_wcid *wcid = dev->mon_wcid;
 	struct mt76_txwi *txwi;
+	struct mt7601u_tx_cb *cb;
 	int pkt_len = skb->len;
 	int hw_q = skb2q(skb);
 
-	BUILD_BUG_ON(ARRAY_SIZE(info->status.status_driver_data) < 1);
-	info->status.status_driver_data[0] = (void *)(unsigned long)pkt_len;
-
 	if (mt7601u_skb_rooms(dev, skb) || mt76_insert_hdr_pad(skb)) {
 		ieee80211_free_txskb(dev->hw, skb);
 		return;
@@ -229,6 +335,11 @@ void mt7601u_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 
 	txwi = mt7601u_push_txwi(dev, skb, sta, wcid, pkt_len);
 
+	cb = mt7601u_tx_skb_cb(skb);
+	cb->pkt_len = pkt_len;
+	cb->wcid = wcid->idx;
+	cb->pktid = MT76_GET(MT_TXWI_LEN_PKTID, le16_to_cpu(txwi->len_ctl));
+
 	if (mt7601u_dma_enqueue_tx(dev, skb, wcid, hw_q)) {
 		ieee80211_free_txskb(dev->hw, skb);
 		return;
@@ -237,35 +348,155 @@ void mt7601u_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 	trace_mt_tx(dev, skb, msta, txwi);
 }
 
+void mt7601u_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
+		struct sk_buff *skb)
+{
+	mt7601u_tx_skb(hw->priv, control->sta, skb);
+}
+
+/* Note: data frames for stations come through mac80211 TXQs.  Active TXQs
+ *	 are served in deficit round robin order (by bytes) and frames are
+ *	 pulled only while the hardware queue holds less than tx_byte_limit
+ *	 bytes, so that the backlog stays in mac80211 where it can be
+ *	 managed rather than in the USB rings.
+ */
+static void mt7601u_tx_schedule_ac(struct mt7601u_dev *dev, int ac)
+{
+	struct ieee80211_txq *txq;
+	struct mt76_txq *mtxq;
+	struct sk_buff *skb;
+	int hw_q = q2hwq(ac);
+
+	/* Scan will kick the tasklet when back on the operating channel */
+	if (test_bit(MT7601U_STATE_OFFCHANNEL, &dev->state))
+		return;
+
+	spin_lock_bh(&dev->txq_lock);
+	while (!list_empty(&dev->txq_list[ac]) &&
+	       mt7601u_dma_tx_room(dev, hw_q)) {
+		mtxq = list_first_entry(&dev->txq_list[ac],
+					struct mt76_txq, list);
+		if (mtxq->deficit <= 0) {
+			mtxq->deficit += MT_TXQ_QUANTUM;
+			list_move_tail(&mtxq->list, &dev->txq_list[ac]);
+			continue;
+		}
+
+		txq = mtxq->txq;
+		skb = ieee80211_tx_dequeue(dev->hw, txq);
+		if (!skb) {
+			list_del_init(&mtxq->list);
+			continue;
+		}
+
+		mtxq->deficit -= skb->len;
+		mt7601u_tx_skb(dev, txq->sta, skb);
+	}
+	spin_unlock_bh(&dev->txq_lock);
+}
+
+void mt7601u_tx_tasklet(unsigned long data)
+{
+	struct mt7601u_dev *dev = (struct mt7601u_dev *)data;
+	int i;
+
+	for (i = 0; i < IEEE80211_NUM_ACS; i++)
+		mt7601u_tx_schedule_ac(dev, i);
+}
+
+void mt7601u_wake_tx_queue(struct ieee80211_hw *hw, struct ieee80211_txq *txq)
+{
+	struct mt7601u_dev *dev = hw->priv;
+	struct mt76_txq *mtxq = (struct mt76_txq *)txq->drv_priv;
+
+	spin_lock_bh(&dev->txq_lock);
+	if (list_empty(&mtxq->list))
+		list_add_tail(&mtxq->list, &dev->txq_list[txq->ac]);
+	spin_unlock_bh(&dev->txq_lock);
+
+	mt7601u_tx_schedule_ac(dev, txq->ac);
+}
+
+void mt7601u_txq_init(struct mt7601u_dev *dev, struct ieee80211_txq *txq)
+{
+	struct mt76_txq *mtxq;
+
+	if (!txq)
+		return;
+
+	mtxq = (struct mt76_txq *)txq->drv_priv;
+	INIT_LIST_HEAD(&mtxq->list);
+	mtxq->txq = txq;
+	mtxq->deficit = MT_TXQ_QUANTUM;
+}
+
+void mt7601u_txq_remove(struct mt7601u_dev *dev, struct ieee80211_txq *txq)
+{
+	struct mt76_txq *mtxq;
+
+	if (!txq)
+		return;
+
+	mtxq = (struct mt76_txq *)txq->drv_priv;
+
+	spin_lock_bh(&dev->txq_lock);
+	list_del_init(&mtxq->list);
+	spin_unlock_bh(&dev->txq_lock);
+}
+
 void mt7601u_tx_stat(struct work_struct *work)
 {
 	struct mt7601u_dev *dev = container_of(work, struct mt7601u_dev,
 					       stat_work.work);
-	struct mt76_tx_status stat;
+	struct mt76_tx_status stat[MT_TX_STAT_BATCH];
 	unsigned long flags;
-	int cleaned = 0;
+	int i, n, cleaned = 0;
+	bool more;
 
-	while (!test_bit(MT7601U_STATE_REMOVED, &dev->state)) {
-		stat = mt7601u_mac_fetch_tx_status(dev);
-		if (!stat.valid)
-			break;
+	do {
+		n = mt7601u_mac_fetch_tx_status(dev, stat, ARRAY_SIZE(stat));
 
-		mt7601u_tx_pktid_dec(dev, &stat);
-		mt76_send_tx_status(dev, &stat);
+		for (i = 0; i < n; i++) {
+			struct sk_buff *skb = NULL;
 
-		cleaned++;
-	}
+			mt7601u_tx_pktid_dec(dev, &stat[i]);
+
+			spin_lock_irqsave(&dev->tx_lock, flags);
+			if (!stat[i].aggr)
+				skb = mt7601u_tx_status_match(dev, &stat[i]);
+			if (skb)
+				mt76_send_tx_status(dev, &stat[i], skb);
+			spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+			if (!skb)
+				mt76_send_tx_status(dev, &stat[i], NULL);
+		}
+
+		cleaned += n;
+	} while (n == ARRAY_SIZE(stat));
 	trace_mt_tx_status_cleaned(dev, cleaned);
 
+	/* Note: polling is started by TX completion and stops once the FIFO
+	 *	 is empty with no TX completions since the last round and no
+	 *	 frames waiting for their status.  Until then back off
+	 *	 from MT_TX_STAT_POLL_MS to MT_TX_STAT_POLL_MAX_MS, going back
+	 *	 to the short interval only if the FIFO had a full batch.
+	 */
 	spin_lock_irqsave(&dev->tx_lock, flags);
-	if (cleaned)
-		queue_delayed_work(dev->stat_wq, &dev->stat_work,
-				   msecs_to_jiffies(10));
-	else if (test_and_clear_bit(MT7601U_STATE_MORE_STATS, &dev->state))
-		queue_delayed_work(dev->stat_wq, &dev->stat_work,
-				   msecs_to_jiffies(20));
-	else
+	mt7601u_tx_status_timeout(dev);
+
+	more = test_and_clear_bit(MT7601U_STATE_MORE_STATS, &dev->state);
+	if (!more && !cleaned && skb_queue_empty(&dev->tx_pending)) {
 		clear_bit(MT7601U_STATE_READING_STATS, &dev->state);
+	} else {
+		if (cleaned >= ARRAY_SIZE(stat))
+			dev->tx_stat_poll_ms = MT_TX_STAT_POLL_MS;
+		else
+			dev->tx_stat_poll_ms = min(dev->tx_stat_poll_ms * 2,
+						   MT_TX_STAT_POLL_MAX_MS);
+		queue_delayed_work(dev->stat_wq, &dev->stat_work,
+				   msecs_to_jiffies(dev->tx_stat_poll_ms));
+	}
 	spin_unlock_irqrestore(&dev->tx_lock, flags);
 }
 
@@ -274,6 +505,7 @@ int mt7601u_conf_tx(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 {
 	struct mt7601u_dev *dev = hw->priv;
 	u8 cw_min = 5, cw_max = 10, hw_q = q2hwq(queue);
+	struct mt7601u_reg_batch b;
 	u32 val;
 
 	/* TODO: should we do funny things with the parameters?
@@ -290,6 +522,8 @@ int mt7601u_conf_tx(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 	WARN_ON(cw_min > 0xf);
 	WARN_ON(cw_max > 0xf);
 
+	mt7601u_batch_init(dev, &b);
+
 	val = MT76_SET(MT_EDCA_CFG_AIFSN, params->aifs) |
 	      MT76_SET(MT_EDCA_CFG_CWMIN, cw_min) |
 	      MT76_SET(MT_EDCA_CFG_CWMAX, cw_max);
@@ -301,27 +535,87 @@ int mt7601u_conf_tx(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 		val |= 0x60;
 	else
 		val |= MT76_SET(MT_EDCA_CFG_TXOP, params->txop);
-	mt76_wr(dev, MT_EDCA_CFG_AC(hw_q), val);
-
-	val = mt76_rr(dev, MT_WMM_TXOP(hw_q));
-	val &= ~(MT_WMM_TXOP_MASK << MT_WMM_TXOP_SHIFT(hw_q));
-	val |= params->txop << MT_WMM_TXOP_SHIFT(hw_q);
-	mt76_wr(dev, MT_WMM_TXOP(hw_q), val);
-
-	val = mt76_rr(dev, MT_WMM_AIFSN);
-	val &= ~(MT_WMM_AIFSN_MASK << MT_WMM_AIFSN_SHIFT(hw_q));
-	val |= params->aifs << MT_WMM_AIFSN_SHIFT(hw_q);
-	mt76_wr(dev, MT_WMM_AIFSN, val);
-
-	val = mt76_rr(dev, MT_WMM_CWMIN);
-	val &= ~(MT_WMM_CWMIN_MASK << MT_WMM_CWMIN_SHIFT(hw_q));
-	val |= cw_min << MT_WMM_CWMIN_SHIFT(hw_q);
-	mt76_wr(dev, MT_WMM_CWMIN, val);
-
-	val = mt76_rr(dev, MT_WMM_CWMAX);
-	val &= ~(MT_WMM_CWMAX_MASK << MT_WMM_CWMAX_SHIFT(hw_q));
-	val |= cw_max << MT_WMM_CWMAX_SHIFT(hw_q);
-	mt76_wr(dev, MT_WMM_CWMAX, val);
+	mt7601u_batch_wr(&b, MT_EDCA_CFG_AC(hw_q), val);
+
+	mt7601u_batch_rmw(&b, MT_WMM_TXOP(hw_q),
+			  MT_WMM_TXOP_MASK << MT_WMM_TXOP_SHIFT(hw_q),
+			  params->txop << MT_WMM_TXOP_SHIFT(hw_q));
+	mt7601u_batch_rmw(&b, MT_WMM_AIFSN,
+			  MT_WMM_AIFSN_MASK << MT_WMM_AIFSN_SHIFT(hw_q),
+			  params->aifs << MT_WMM_AIFSN_SHIFT(hw_q));
+	mt7601u_batch_rmw(&b, MT_WMM_CWMIN,
+			  MT_WMM_CWMIN_MASK << MT_WMM_CWMIN_SHIFT(hw_q),
+			  cw_min << MT_WMM_CWMIN_SHIFT(hw_q));
+	mt7601u_batch_rmw(&b, MT_WMM_CWMAX,
+			  MT_WMM_CWMAX_MASK << MT_WMM_CWMAX_SHIFT(hw_q),
+			  cw_max << MT_WMM_CWMAX_SHIFT(hw_q));
+
+	return mt7601u_batch_commit(&b);
+}
+
+/* Note: skbs are allocated the way mac80211 would, with the headroom we
+ *	 ask for, so only reallocations done by the driver are counted.  QoS
+ *	 data header is used to exercise header padding.
+ */
+int mt7601u_bench_tx(struct mt7601u_dev *dev, u32 frame_len, int iters,
+		     struct mt7601u_bench_res *res)
+{
+	struct ieee80211_tx_info *info;
+	struct ieee80211_qos_hdr *hdr;
+	struct mt76_wcid wcid;
+	int headroom = dev->hw->extra_tx_headroom;
+	struct sk_buff *skb;
+	unsigned char *head;
+	ktime_t start;
+	int i, len, ret;
+
+	frame_len = max_t(u32, frame_len, sizeof(*hdr));
+
+	mt76_mac_wcid_init(&wcid, dev->mon_wcid->idx);
+	wcid.tmpl.rate_set = true;
+
+	memset(res, 0, sizeof(*res));
+
+	for (i = 0; i < iters; i++) {
+		/* + worst case tailroom from mt7601u_skb_rooms() */
+		skb = alloc_skb(headroom + frame_len + 4 + 4 + 3, GFP_KERNEL);
+		if (!skb)
+			return -ENOMEM;
+
+		skb_reserve(skb, headroom);
+		hdr = (void *)skb_put(skb, frame_len);
+		memset(hdr, 0, frame_len);
+		hdr->frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA |
+						 IEEE80211_STYPE_QOS_DATA);
+
+		info = IEEE80211_SKB_CB(skb);
+		memset(info, 0, sizeof(*info));
+		info->control.rates[0].idx = 0;
+		info->control.rates[0].count = 1;
+
+		head = skb->head;
+		len = skb->len;
+
+		start = ktime_get();
+		ret = mt7601u_skb_rooms(dev, skb) || mt76_insert_hdr_pad(skb);
+		if (!ret) {
+			mt7601u_push_txwi(dev, skb, NULL, &wcid, len);
+			mt7601u_dma_skb_wrap_pkt(skb, MT_QSEL_EDCA, 0);
+		}
+		res->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		res->allocs += skb->head != head;
+		kfree_skb(skb);
+		if (ret)
+			return -ENOMEM;
+		res->frames++;
+	}
+
+	for (i = 0; i < iters; i++) {
+		start = ktime_get();
+		res->ns -= min_t(u64, res->ns,
+				 ktime_to_ns(ktime_sub(ktime_get(), start)));
+	}
 
 	return 0;
 }
@@ -14,9 +14,11 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/usb.h>
+#include <linux/slab.h>
 
 #include "mt7601u.h"
 #include "usb.h"
+#include "eeprom.h"
 #include "trace.h"
 
 static struct usb_device_id mt7601u_device_table[] = {
@@ -92,22 +94,29 @@ __mt7601u_vendor_request(struct mt7601u_dev *dev, const u8 req,
 	const u8 req_type = direction | USB_TYPE_VENDOR | USB_RECIP_DEVICE;
 	const unsigned int pipe = (direction == USB_DIR_IN) ?
 		usb_rcvctrlpipe(usb_dev, 0) : usb_sndctrlpipe(usb_dev, 0);
+	ktime_t start = ktime_get();
 
 	for (i = 0; i < MT_VEND_REQ_MAX_RETRY; i++) {
 		ret = usb_control_msg(usb_dev, pipe, req, req_type,
 				      val, offset, buf, buflen,
 				      MT_VEND_REQ_TOUT_MS);
+		dev->vend_req_cnt++;
 		trace_mt_vend_req(dev, pipe, req, req_type, val, offset,
 				  buf, buflen, ret);
 
 		if (ret >= 0 || ret == -ENODEV)
-			return ret;
+			goto out;
 
+		mt7601u_sw_stat_inc(dev, MT_SW_STAT_VEND_REQ_RETRY);
 		msleep(5);
 	}
 
+	mt7601u_sw_stat_inc(dev, MT_SW_STAT_VEND_REQ_FAIL);
+
 	dev_err(dev->dev, "Vendor request req:%02x off:%04x failed:%d\n",
 		req, offset, ret);
+out:
+	mt7601u_lat_account(dev, MT_LAT_VEND_REQ, start);
 
 	return ret;
 }
@@ -117,8 +126,10 @@ mt7601u_vendor_request(struct mt7601u_dev *dev, const u8 req,
 		       const u8 direction, const u16 val, const u16 offset,
 		       void *buf, const size_t buflen)
 {
+	struct mt7601u_prof_ctx prof;
 	int ret;
 
+	mt7601u_prof_enter(dev, &prof);
 	mutex_lock(&dev->vendor_req_mutex);
 
 	ret = __mt7601u_vendor_request(dev, req, direction, val, offset,
@@ -127,6 +138,7 @@ mt7601u_vendor_request(struct mt7601u_dev *dev, const u8 req,
 		set_bit(MT7601U_STATE_REMOVED, &dev->state);
 
 	mutex_unlock(&dev->vendor_req_mutex);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_VEND, _RET_IP_);
 
 	return ret;
 }
@@ -139,12 +151,15 @@ void mt7601u_vendor_reset(struct mt7601u_dev *dev)
 
 u32 mt7601u_rr(struct mt7601u_dev *dev, u32 offset)
 {
+	struct mt7601u_prof_ctx prof;
 	int ret;
 	__le32 reg;
 	u32 val;
 
 	WARN_ONCE(offset > USHRT_MAX, "read high off:%08x", offset);
 
+	mt7601u_prof_enter(dev, &prof);
+
 	ret = mt7601u_vendor_request(dev, MT_VEND_MULTI_READ, USB_DIR_IN,
 				     0, offset, &reg, sizeof(reg));
 	val = le32_to_cpu(reg);
@@ -153,11 +168,87 @@ u32 mt7601u_rr(struct mt7601u_dev *dev, u32 offset)
 			ret, offset);
 		val = ~0;
 	}
+	mt7601u_prof_exit(dev, &prof, MT_PROF_RR, _RET_IP_);
 
 	trace_reg_read(dev, offset, val);
 	return val;
 }
 
+/* Read @n consecutive registers starting at @offset with a single
+ * MULTI_READ control transfer.  Falls back to reading registers one by one
+ * if device doesn't support MULTI_READ over a span.
+ * Note: registers in the span may be clear-on-read (MAC counters), after
+ *	 a failed or short transfer some of them may already be cleared so
+ *	 they are not read again, @vals are zeroed instead.  Caller must make
+ *	 sure there are no FIFOs within the span.
+ */
+static void
+__mt7601u_rr_span(struct mt7601u_dev *dev, u32 offset, u32 *vals, int n)
+{
+	const int len = n * sizeof(__le32);
+	bool fallback = false;
+	__le32 *buf;
+	int i, ret;
+
+	WARN_ONCE(offset + len > USHRT_MAX, "read high off:%08x", offset);
+
+	if (n <= 1 || READ_ONCE(dev->vend_no_multi_rd))
+		goto fallback;
+
+	buf = kmalloc(len, GFP_KERNEL);
+	if (!buf)
+		goto fallback;
+
+	mutex_lock(&dev->vendor_req_mutex);
+	ret = __mt7601u_vendor_request(dev, MT_VEND_MULTI_READ, USB_DIR_IN,
+				       0, offset, buf, len);
+	if (ret == len) {
+		dev->vend_multi_rd_ok = true;
+	} else if (ret == -ENODEV) {
+		set_bit(MT7601U_STATE_REMOVED, &dev->state);
+	} else if (!dev->vend_multi_rd_ok &&
+		   (ret == -EPIPE || ret == -EOPNOTSUPP)) {
+		/* Nothing was read, safe to retry register by register */
+		dev_warn(dev->dev,
+			 "Warning: multi read of %d regs failed:%d, reading one by one\n",
+			 n, ret);
+		dev->vend_no_multi_rd = true;
+		fallback = true;
+	} else if (ret >= 0) {
+		dev_err(dev->dev, "Error: wrong size read:%d off:%08x\n",
+			ret, offset);
+	}
+	mutex_unlock(&dev->vendor_req_mutex);
+
+	if (ret != len) {
+		kfree(buf);
+		if (fallback)
+			goto fallback;
+		memset(vals, 0, len);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		vals[i] = le32_to_cpu(buf[i]);
+		trace_reg_read(dev, offset + i * 4, vals[i]);
+	}
+
+	kfree(buf);
+	return;
+fallback:
+	for (i = 0; i < n; i++)
+		vals[i] = mt7601u_rr(dev, offset + i * 4);
+}
+
+void mt7601u_rr_span(struct mt7601u_dev *dev, u32 offset, u32 *vals, int n)
+{
+	struct mt7601u_prof_ctx prof;
+
+	mt7601u_prof_enter(dev, &prof);
+	__mt7601u_rr_span(dev, offset, vals, n);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_RR_SPAN, _RET_IP_);
+}
+
 int mt7601u_vendor_single_wr(struct mt7601u_dev *dev, const u8 req,
 			     const u16 offset, const u32 val)
 {
@@ -171,27 +262,90 @@ int mt7601u_vendor_single_wr(struct mt7601u_dev *dev, const u8 req,
 				      val >> 16, offset + 2, NULL, 0);
 }
 
+/* Write whole register in one control transfer.  Returns -EOPNOTSUPP if
+ * device previously rejected MULTI_WRITE and caller has to fall back to
+ * two 16-bit writes.
+ */
+static int
+mt7601u_vendor_multi_wr(struct mt7601u_dev *dev, const u16 offset,
+			const u32 val)
+{
+	int ret;
+
+	mutex_lock(&dev->vendor_req_mutex);
+
+	if (dev->vend_no_multi_wr) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	*dev->vend_buf = cpu_to_le32(val);
+	ret = __mt7601u_vendor_request(dev, MT_VEND_MULTI_WRITE, USB_DIR_OUT,
+				       0, offset, dev->vend_buf,
+				       sizeof(*dev->vend_buf));
+	if (ret == -ENODEV) {
+		set_bit(MT7601U_STATE_REMOVED, &dev->state);
+	} else if (ret < 0) {
+		/* Device which never took a MULTI_WRITE and stalls it doesn't
+		 * support it, other errors are transient bus problems.
+		 */
+		if (!dev->vend_multi_wr_ok &&
+		    (ret == -EPIPE || ret == -EOPNOTSUPP)) {
+			dev_warn(dev->dev,
+				 "Warning: multi write failed:%d, using 16-bit writes\n",
+				 ret);
+			dev->vend_no_multi_wr = true;
+			ret = -EOPNOTSUPP;
+		}
+	} else if (ret != sizeof(*dev->vend_buf)) {
+		dev_err(dev->dev, "Error: wrong size write:%d off:%08x\n",
+			ret, offset);
+		ret = -EIO;
+	} else {
+		dev->vend_multi_wr_ok = true;
+		ret = 0;
+	}
+out:
+	mutex_unlock(&dev->vendor_req_mutex);
+
+	return ret;
+}
+
 void mt7601u_wr(struct mt7601u_dev *dev, u32 offset, u32 val)
 {
+	struct mt7601u_prof_ctx prof;
+
 	WARN_ONCE(offset > USHRT_MAX, "write high off:%08x", offset);
 
-	mt7601u_vendor_single_wr(dev, MT_VEND_WRITE, offset, val);
+	mt7601u_prof_enter(dev, &prof);
+	if (mt7601u_vendor_multi_wr(dev, offset, val) == -EOPNOTSUPP)
+		mt7601u_vendor_single_wr(dev, MT_VEND_WRITE, offset, val);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_WR, _RET_IP_);
 	trace_reg_write(dev, offset, val);
 }
 
 u32 mt7601u_rmw(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val)
 {
+	struct mt7601u_prof_ctx prof;
+
+	mt7601u_prof_enter(dev, &prof);
 	val |= mt7601u_rr(dev, offset) & ~mask;
 	mt7601u_wr(dev, offset, val);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_RMW, _RET_IP_);
 	return val;
 }
 
 u32 mt7601u_rmc(struct mt7601u_dev *dev, u32 offset, u32 mask, u32 val)
 {
-	u32 reg = mt7601u_rr(dev, offset);
+	struct mt7601u_prof_ctx prof;
+	u32 reg;
+
+	mt7601u_prof_enter(dev, &prof);
+	reg = mt7601u_rr(dev, offset);
 	val |= reg & ~mask;
 	if (reg != val)
 		mt7601u_wr(dev, offset, val);
+	mt7601u_prof_exit(dev, &prof, MT_PROF_RMW, _RET_IP_);
 	return val;
 }
 
@@ -247,6 +401,11 @@ static int mt7601u_assign_pipes(struct usb_interface *usb_intf,
 	return 0;
 }
 
+static bool deferred_init;
+module_param(deferred_init, bool, S_IRUGO);
+MODULE_PARM_DESC(deferred_init,
+		 "register with mac80211 right after reading EEPROM and finish HW init in the background");
+
 static int mt7601u_probe(struct usb_interface *usb_intf,
 			 const struct usb_device_id *id)
 {
@@ -280,7 +439,21 @@ static int mt7601u_probe(struct usb_interface *usb_intf,
 	if (!(mt7601u_rr(dev, MT_EFUSE_CTRL) & MT_EFUSE_CTRL_SEL))
 		dev_warn(dev->dev, "Warning: eFUSE not present\n");
 
+	if (deferred_init) {
+		ret = mt7601u_init_early(dev);
+		if (ret)
+			goto err;
+		ret = mt7601u_register_device(dev);
+		if (ret)
+			goto err;
+
+		queue_work(system_unbound_wq, &dev->init_work);
+		return 0;
+	}
+
+	mutex_lock(&dev->mutex);
 	ret = mt7601u_init_hardware(dev);
+	mutex_unlock(&dev->mutex);
 	if (ret)
 		goto err;
 	ret = mt7601u_register_device(dev);
@@ -288,6 +461,9 @@ static int mt7601u_probe(struct usb_interface *usb_intf,
 		goto err_hw;
 
 	set_bit(MT7601U_STATE_INITIALIZED, &dev->state);
+	complete_all(&dev->init_done);
+	/* debugfs readers expect DMA and MCU to be set up */
+	mt7601u_init_debugfs(dev);
 
 	return 0;
 err_hw:
@@ -297,6 +473,9 @@ err:
 	usb_put_dev(interface_to_usbdev(usb_intf));
 
 	destroy_workqueue(dev->stat_wq);
+	if (dev->io_wq)
+		destroy_workqueue(dev->io_wq);
+	free_percpu(dev->sw_stats);
 	ieee80211_free_hw(dev->hw);
 	return ret;
 }
@@ -305,24 +484,48 @@ static void mt7601u_disconnect(struct usb_interface *usb_intf)
 {
 	struct mt7601u_dev *dev = usb_get_intfdata(usb_intf);
 
+	flush_work(&dev->init_work);
 	ieee80211_unregister_hw(dev->hw);
-	mt7601u_cleanup(dev);
+	if (test_bit(MT7601U_STATE_INITIALIZED, &dev->state))
+		mt7601u_cleanup(dev);
+	kfree(rcu_access_pointer(dev->ap_bssid));
 
 	usb_set_intfdata(usb_intf, NULL);
 	usb_put_dev(interface_to_usbdev(usb_intf));
 
 	destroy_workqueue(dev->stat_wq);
+	if (dev->io_wq)
+		destroy_workqueue(dev->io_wq);
+	free_percpu(dev->sw_stats);
 	ieee80211_free_hw(dev->hw);
 }
 
 static int mt7601u_suspend(struct usb_interface *usb_intf, pm_message_t state)
 {
-	return -1;
+	struct mt7601u_dev *dev = usb_get_intfdata(usb_intf);
+
+	/* Deferred init failed, resume will retry it */
+	flush_work(&dev->init_work);
+	if (!test_bit(MT7601U_STATE_INITIALIZED, &dev->state))
+		return 0;
+
+	mt7601u_suspend_hw(dev);
+
+	return 0;
 }
 
 static int mt7601u_resume(struct usb_interface *usb_intf)
 {
-	return -1;
+	struct mt7601u_dev *dev = usb_get_intfdata(usb_intf);
+
+	return mt7601u_resume_hw(dev, false);
+}
+
+static int mt7601u_reset_resume(struct usb_interface *usb_intf)
+{
+	struct mt7601u_dev *dev = usb_get_intfdata(usb_intf);
+
+	return mt7601u_resume_hw(dev, true);
 }
 
 MODULE_DEVICE_TABLE(usb, mt7601u_device_table);
@@ -336,8 +539,21 @@ static struct usb_driver mt7601u_driver = {
 	.disconnect	= mt7601u_disconnect,
 	.suspend	= mt7601u_suspend,
 	.resume		= mt7601u_resume,
-	.reset_resume	= mt7601u_resume,
+	.reset_resume	= mt7601u_reset_resume,
 	.soft_unbind	= 1,
 	.disable_hub_initiated_lpm = 1,
 };
-module_usb_driver(mt7601u_driver);
+
+static int __init mt7601u_module_init(void)
+{
+	return usb_register(&mt7601u_driver);
+}
+
+static void __exit mt7601u_module_exit(void)
+{
+	usb_deregister(&mt7601u_driver);
+	mt7601u_eeprom_cache_free();
+}
+
+module_init(mt7601u_module_init);
+module_exit(mt7601u_module_exit);
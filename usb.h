@@ -26,6 +26,7 @@
 enum mt_vendor_req {
 	MT_VEND_DEV_MODE = 1,
 	MT_VEND_WRITE = 2,
+	MT_VEND_MULTI_WRITE = 6,
 	MT_VEND_MULTI_READ = 7,
 	MT_VEND_WRITE_FCE = 0x42,
 };
@@ -13,6 +13,29 @@
 
 #include "mt7601u.h"
 
+/* Sum per-CPU @sw_stats counters into @sum (__MT_SW_STAT_MAX entries). */
+void mt7601u_sw_stat_sum(struct mt7601u_dev *dev, u64 *sum)
+{
+	int cpu, i;
+
+	memset(sum, 0, sizeof(u64) * __MT_SW_STAT_MAX);
+
+	for_each_possible_cpu(cpu) {
+		const struct mt7601u_sw_stats *st;
+		u64 cnt[__MT_SW_STAT_MAX];
+		unsigned int start;
+
+		st = per_cpu_ptr(dev->sw_stats, cpu);
+		do {
+			start = u64_stats_fetch_begin_irq(&st->syncp);
+			memcpy(cnt, st->cnt, sizeof(cnt));
+		} while (u64_stats_fetch_retry_irq(&st->syncp, start));
+
+		for (i = 0; i < __MT_SW_STAT_MAX; i++)
+			sum[i] += cnt[i];
+	}
+}
+
 void mt76_remove_hdr_pad(struct sk_buff *skb)
 {
 	int len = ieee80211_get_hdrlen_from_skb(skb);